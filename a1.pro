@@ -3,10 +3,16 @@
 ######################################################################
 
 QT+=widgets
+CONFIG += c++14
 TEMPLATE = app
 TARGET = a1
 INCLUDEPATH += .
 
 # Input
-HEADERS += game.h renderer.h window.h
-SOURCES += game.cpp main.cpp renderer.cpp window.cpp
+HEADERS += autoplayer.h basicgame.h bufferpool.h game.h gamethread.h movegen.h pieces.h rng.h renderer.h replay.h spscqueue.h trace.h triplebuffer.h window.h
+SOURCES += autoplayer.cpp bufferpool.cpp game.cpp gamethread.cpp main.cpp movegen.cpp renderer.cpp replay.cpp trace.cpp window.cpp
+
+# qmake CONFIG+=trace builds in TRACE_SCOPE timing (File > Save Trace)
+trace {
+    DEFINES += TRACE_ENABLED
+}
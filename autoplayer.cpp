@@ -0,0 +1,225 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * AutoPlayer - see autoplayer.h.
+ */
+
+#include <algorithm>
+#include <cstdlib>
+#include <cfloat>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "autoplayer.h"
+
+// Height used for the walls either side of the well, so the outermost
+// columns only see a well or a step on their inner side.
+static const short WALL_HEIGHT = 0x3FFF;
+
+// Room for 64 columns, the walls and the 8-lane tail of the last load.
+static const int PROFILE_SIZE = 64 + 2 + 8;
+
+AutoPlayer::Weights AutoPlayer::defaultWeights()
+{
+  Weights w;
+  w.w[FEATURE_HEIGHT] = -0.51f;
+  w.w[FEATURE_LINES] = 0.76f;
+  w.w[FEATURE_HOLES] = -0.36f;
+  w.w[FEATURE_BUMPINESS] = -0.18f;
+  w.w[FEATURE_WELLS] = -0.10f;
+  w.w[FEATURE_ROW_TRANSITIONS] = -0.10f;
+  w.w[FEATURE_COL_TRANSITIONS] = -0.20f;
+  return w;
+}
+
+AutoPlayer::AutoPlayer()
+  : weights_(defaultWeights())
+  , evaluations_(0)
+{}
+
+AutoPlayer::AutoPlayer(const Weights& weights)
+  : weights_(weights)
+  , evaluations_(0)
+{}
+
+// Sum of column heights, bumpiness and well depths over the column
+// profile p, where p[0] and p[width+1] are the walls and p[1..width]
+// the heights.
+static void measureProfile(const short *p, int width,
+                           int& height, int& bumpiness, int& wells)
+{
+#ifdef __SSE2__
+  // Eight columns per step: each lane looks at its own height and its
+  // two neighbours, loaded as three overlapping vectors.  Lanes past
+  // the last column (or the last pair, for bumpiness) are masked off.
+  // A lane holds at most height + 4 (4100), so one step fits in 16 bits
+  // but eight of them need not; each step is widened to 32 bits, pairs
+  // of lanes added, before it is accumulated.
+  const __m128i ones = _mm_set1_epi16(1);
+  const __m128i lane = _mm_setr_epi16(0, 1, 2, 3, 4, 5, 6, 7);
+  const __m128i last = _mm_set1_epi16(width);
+  const __m128i lastPair = _mm_set1_epi16(width - 1);
+  __m128i hsum = _mm_setzero_si128();
+  __m128i bsum = _mm_setzero_si128();
+  __m128i wsum = _mm_setzero_si128();
+
+  for(int c = 0; c < width; c += 8) {
+    __m128i left = _mm_loadu_si128((const __m128i*)(p + c));
+    __m128i mid = _mm_loadu_si128((const __m128i*)(p + c + 1));
+    __m128i right = _mm_loadu_si128((const __m128i*)(p + c + 2));
+    __m128i col = _mm_add_epi16(lane, _mm_set1_epi16(c));
+    __m128i valid = _mm_cmplt_epi16(col, last);
+    __m128i validPair = _mm_cmplt_epi16(col, lastPair);
+
+    __m128i step = _mm_max_epi16(_mm_sub_epi16(mid, right),
+                                 _mm_sub_epi16(right, mid));
+    __m128i depth = _mm_max_epi16(
+      _mm_sub_epi16(_mm_min_epi16(left, right), mid), _mm_setzero_si128());
+
+    hsum = _mm_add_epi32(hsum, _mm_madd_epi16(_mm_and_si128(mid, valid), ones));
+    bsum = _mm_add_epi32(bsum, _mm_madd_epi16(_mm_and_si128(step, validPair), ones));
+    wsum = _mm_add_epi32(wsum, _mm_madd_epi16(_mm_and_si128(depth, valid), ones));
+  }
+
+  // Reduce all three at once by transposing.
+  __m128i z = _mm_setzero_si128();
+  __m128i hb = _mm_add_epi32(_mm_unpacklo_epi32(hsum, bsum),
+                             _mm_unpackhi_epi32(hsum, bsum));
+  __m128i wz = _mm_add_epi32(_mm_unpacklo_epi32(wsum, z),
+                             _mm_unpackhi_epi32(wsum, z));
+  __m128i sum = _mm_add_epi32(_mm_unpacklo_epi64(hb, wz),
+                              _mm_unpackhi_epi64(hb, wz));
+
+  int out[4];
+  _mm_storeu_si128((__m128i*) out, sum);
+  height = out[0];
+  bumpiness = out[1];
+  wells = out[2];
+#else
+  height = bumpiness = wells = 0;
+  for(int c = 1; c <= width; ++c) {
+    height += p[c];
+    if(c < width) {
+      bumpiness += std::abs(p[c] - p[c+1]);
+    }
+    wells += std::max(std::min(p[c-1], p[c+1]) - p[c], 0);
+  }
+#endif
+}
+
+void AutoPlayer::measure(const Board& board, float features[NUM_FEATURES])
+{
+  int width = board.width;
+  RowBits inner = board.full >> 1;
+  short profile[PROFILE_SIZE] = { 0 };
+
+  profile[0] = WALL_HEIGHT;
+  profile[width + 1] = WALL_HEIGHT;
+
+  int top = board.height + 3;
+  while(top >= 0 && !board.rows[top]) {
+    --top;
+  }
+
+  // Walk down from the top of the stack.  The first filled cell met in
+  // a column gives its height; every filled cell below the top of its
+  // column is counted, so holes fall out as heights minus cells.
+  RowBits seen = 0;
+  int cells = 0;
+  int rowTransitions = 0;
+  int colTransitions = 0;
+
+  for(int r = top; r >= 0; --r) {
+    RowBits row = board.rows[r];
+    RowBits fresh = row & ~seen;
+
+    while(fresh) {
+      profile[1 + __builtin_ctzll(fresh)] = r + 1;
+      fresh &= fresh - 1;
+    }
+    seen |= row;
+    cells += __builtin_popcountll(row);
+
+    rowTransitions += __builtin_popcountll((row ^ (row >> 1)) & inner)
+                      + !(row & 1) + !((row >> (width - 1)) & 1);
+    if(r < top) {
+      colTransitions += __builtin_popcountll(row ^ board.rows[r + 1]);
+    }
+  }
+  colTransitions += __builtin_popcountll(~board.rows[0] & board.full);
+
+  int height, bumpiness, wells;
+  measureProfile(profile, width, height, bumpiness, wells);
+
+  features[FEATURE_HEIGHT] = height;
+  features[FEATURE_LINES] = 0;
+  features[FEATURE_HOLES] = height - cells;
+  features[FEATURE_BUMPINESS] = bumpiness;
+  features[FEATURE_WELLS] = wells;
+  features[FEATURE_ROW_TRANSITIONS] = rowTransitions;
+  features[FEATURE_COL_TRANSITIONS] = colTransitions;
+}
+
+float AutoPlayer::evaluate(const Board& board, int lines) const
+{
+  float f[NUM_FEATURES];
+  measure(board, f);
+  f[FEATURE_LINES] = lines;
+
+  float score = 0.0f;
+  for(int i = 0; i < NUM_FEATURES; ++i) {
+    score += weights_.w[i] * f[i];
+  }
+  return score;
+}
+
+bool AutoPlayer::choose(const Game& game, Placement& best)
+{
+  board_.load(game);
+  int n = gen_.generate(board_, game.getPiece(), game.getPieceX(),
+                        game.getPieceY(), placements_);
+  if(n == 0) {
+    return false;
+  }
+
+  float bestScore = -FLT_MAX;
+  best = placements_[0];
+
+  for(int i = 0; i < n; ++i) {
+    const Placement& p = placements_[i];
+
+    scratch_.width = board_.width;
+    scratch_.height = board_.height;
+    scratch_.full = board_.full;
+    scratch_.rows.assign(board_.rows.begin(), board_.rows.end());
+
+    int lines = scratch_.lock(p.piece, p.x, p.y);
+    float score = lines < 0 ? -FLT_MAX : evaluate(scratch_, lines);
+    ++evaluations_;
+
+    if(score > bestScore) {
+      bestScore = score;
+      best = p;
+    }
+  }
+
+  return true;
+}
+
+bool AutoPlayer::play(Game& game)
+{
+  Placement best;
+  path_.clear();
+  if(!choose(game, best)) {
+    return false;
+  }
+
+  gen_.getPath(best, path_);
+  for(size_t i = 0; i < path_.size(); ++i) {
+    game.apply(path_[i]);
+  }
+  return true;
+}
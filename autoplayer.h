@@ -0,0 +1,88 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * AutoPlayer - plays the game unattended.  Every placement the move
+ * generator finds is scored with a weighted sum of standard board
+ * features and the best one is played through the normal Game moves.
+ */
+
+#ifndef AUTOPLAYER_H
+#define AUTOPLAYER_H
+
+#include <vector>
+
+#include "game.h"
+#include "movegen.h"
+
+class AutoPlayer
+{
+public:
+  // Board features, measured after the piece has locked and any
+  // completed rows have been removed.
+  enum Feature {
+    FEATURE_HEIGHT,           // sum of column heights
+    FEATURE_LINES,            // rows removed by this placement
+    FEATURE_HOLES,            // empty cells below the top of their column
+    FEATURE_BUMPINESS,        // sum of height differences between neighbours
+    FEATURE_WELLS,            // sum of depths below both neighbours
+    FEATURE_ROW_TRANSITIONS,  // filled/empty changes along rows, walls filled
+    FEATURE_COL_TRANSITIONS,  // filled/empty changes up columns, floor filled
+    NUM_FEATURES
+  };
+
+  struct Weights
+  {
+    float w[NUM_FEATURES];
+  };
+
+  // Weights that play a reasonable game on the standard well.
+  static Weights defaultWeights();
+
+  AutoPlayer();
+  explicit AutoPlayer(const Weights& weights);
+
+  void setWeights(const Weights& weights)
+  {
+    weights_ = weights;
+  }
+  const Weights& getWeights() const
+  {
+    return weights_;
+  }
+
+  // Pick the best placement for the falling piece.  Returns false if
+  // the piece has nowhere to go.
+  bool choose(const Game& game, Placement& best);
+
+  // Choose a placement and make the moves that take the piece there.
+  // The piece is left at rest; the next tick() locks it.
+  bool play(Game& game);
+
+  // The moves the last play() made, for anyone recording the game.
+  const std::vector<Game::Move>& getLastPath() const
+  {
+    return path_;
+  }
+
+  // Measure a board, and score it given the rows the placement removed.
+  static void measure(const Board& board, float features[NUM_FEATURES]);
+  float evaluate(const Board& board, int lines) const;
+
+  // Number of placements scored so far, for benchmarking.
+  long long getEvaluations() const
+  {
+    return evaluations_;
+  }
+
+private:
+  Weights weights_;
+  MoveGen gen_;
+  Board board_;
+  Board scratch_;
+  std::vector<Placement> placements_;
+  std::vector<Game::Move> path_;
+  long long evaluations_;
+};
+
+#endif // AUTOPLAYER_H
@@ -0,0 +1,438 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * BasicGame - the same game as Game, for a well whose size is fixed at
+ * compile time.  Every array is sized by the template arguments and
+ * held inline, rows are the narrowest word that holds W columns, and
+ * every loop over the width has a constant trip count, so the compiler
+ * can unroll it.  For the standard well the occupancy bits of the
+ * whole board fit in one cache line.
+ *
+ * BasicGame plays exactly as Game does: the same pieces for the same
+ * seed, the same moves, the same getChecksum().  It leaves out what
+ * only the window and the tools need (undo, snapshots, deltas); Game
+ * remains the version to use for a well sized at run time and for
+ * anything that needs those.
+ */
+
+#ifndef BASICGAME_H
+#define BASICGAME_H
+
+#include <algorithm>
+#include <cstring>
+
+#include "game.h"
+
+// The narrowest unsigned word with at least W bits.
+template<int W, bool Fits16 = (W <= 16), bool Fits32 = (W <= 32)>
+struct BasicRowWord
+{
+  typedef unsigned long long type;
+};
+template<int W, bool Fits32>
+struct BasicRowWord<W, true, Fits32>
+{
+  typedef unsigned short type;
+};
+template<int W>
+struct BasicRowWord<W, false, true>
+{
+  typedef unsigned int type;
+};
+
+template<int W, int H>
+class BasicGame
+{
+  static_assert(W >= 4 && W <= 64, "well must be 4 to 64 columns wide");
+  static_assert(H >= 4, "well must be at least 4 rows high");
+
+public:
+  typedef Game::Randomizer Randomizer;
+  typedef Game::Move Move;
+  typedef typename BasicRowWord<W>::type Word;
+
+  static const int PREVIEW_SIZE = Game::PREVIEW_SIZE;
+
+  explicit BasicGame(unsigned long long seed = 0,
+                     Randomizer randomizer = Game::RANDOM_UNIFORM)
+    : rng_(seed)
+    , randomizer_(randomizer)
+  {
+    reset();
+  }
+
+  void reset()
+  {
+    stopped_ = false;
+    pieces_ = 0;
+    queue_head_ = 0;
+    queue_count_ = 0;
+    std::fill(rows_, rows_ + ROWS, 0);
+    std::memset(colours_, -1, sizeof(colours_));
+    std::fill(heights_, heights_ + W, 0);
+    std::fill(row_fill_, row_fill_ + ROWS, 0);
+    height_sum_ = 0;
+    cells_ = 0;
+    generateNewPiece();
+  }
+  void reset(unsigned long long seed)
+  {
+    rng_.reseed(seed);
+    reset();
+  }
+
+  void setRandomizer(Randomizer randomizer)
+  {
+    randomizer_ = randomizer;
+  }
+  Randomizer getRandomizer() const
+  {
+    return randomizer_;
+  }
+
+  int getNextPiece(int i) const
+  {
+    return queue_[ (queue_head_ + i) % QUEUE_SIZE ];
+  }
+
+  // See Game::tick().
+  int tick()
+  {
+    if(stopped_) {
+      return -1;
+    }
+
+    if(!doesPieceFit(piece_, px_, py_ - 1)) {
+      placePiece(piece_, px_, py_);
+      if(py_ >= H) {
+        stopped_ = true;
+        return -1;
+      }
+      int rm = collapse(py_);
+      generateNewPiece();
+      return rm;
+    }
+    --py_;
+    return 0;
+  }
+
+  bool moveLeft()
+  {
+    return tryMove(piece_, px_ - 1, py_);
+  }
+  bool moveRight()
+  {
+    return tryMove(piece_, px_ + 1, py_);
+  }
+  bool moveDown()
+  {
+    return tryMove(piece_, px_, py_ - 1);
+  }
+  bool rotateCW()
+  {
+    return tryMove(piece_.rotateCW(), px_, py_);
+  }
+  bool rotateCCW()
+  {
+    return tryMove(piece_.rotateCCW(), px_, py_);
+  }
+
+  bool drop()
+  {
+    // As Game::drop(): straight onto the skyline, unless the piece is
+    // tucked under an overhang.
+    int ny = landingRow(piece_, px_);
+    if(ny > py_) {
+      ny = py_;
+      while(doesPieceFit(piece_, px_, ny - 1)) {
+        --ny;
+      }
+    }
+    if(ny == py_) {
+      return false;
+    }
+    py_ = ny;
+    return true;
+  }
+
+  bool apply(Move move)
+  {
+    switch(move) {
+    case Game::MOVE_LEFT:
+      return moveLeft();
+    case Game::MOVE_RIGHT:
+      return moveRight();
+    case Game::MOVE_CW:
+      return rotateCW();
+    case Game::MOVE_CCW:
+      return rotateCCW();
+    case Game::MOVE_DOWN:
+      return moveDown();
+    case Game::MOVE_DROP:
+      return drop();
+    }
+    return false;
+  }
+
+  const Piece& getPiece() const
+  {
+    return piece_;
+  }
+  int getPieceX() const
+  {
+    return px_;
+  }
+  int getPieceY() const
+  {
+    return py_;
+  }
+
+  bool isOver() const
+  {
+    return stopped_;
+  }
+  long getPieceCount() const
+  {
+    return pieces_;
+  }
+
+  static constexpr int getWidth()
+  {
+    return W;
+  }
+  static constexpr int getHeight()
+  {
+    return H;
+  }
+
+  // See Game::get() and Game::getRowBits().
+  int get(int r, int c) const
+  {
+    int br = py_ - r;
+    int bc = c - px_;
+    if(br >= 0 && br < 4 && bc >= 0 && bc < 4 && piece_.isOn(br, bc)) {
+      return piece_.getColourIndex();
+    }
+    return colours_[r][c];
+  }
+  RowBits getRowBits(int r) const
+  {
+    return rows_[r];
+  }
+
+  int getColumnHeight(int c) const
+  {
+    return heights_[c];
+  }
+  int getHoles() const
+  {
+    return height_sum_ - cells_;
+  }
+  int getRowFill(int r) const
+  {
+    return row_fill_[r];
+  }
+
+  // Same hash as Game::getChecksum(), so the two can be checked
+  // against each other.
+  unsigned long long getChecksum() const
+  {
+    unsigned long long h = 0xCBF29CE484222325ULL;
+    const unsigned long long prime = 0x100000001B3ULL;
+
+    for(int r = 0; r < ROWS; ++r) {
+      for(int c = 0; c < W; ++c) {
+        h = (h ^ (unsigned char) get(r, c)) * prime;
+      }
+    }
+    int extra[] = { piece_.getType(), piece_.getRotation(), px_, py_,
+                    (int) pieces_, stopped_ };
+    for(int i = 0; i < 6; ++i) {
+      h = (h ^ (unsigned) extra[i]) * prime;
+    }
+    for(int i = 0; i < PREVIEW_SIZE; ++i) {
+      h = (h ^ (unsigned) getNextPiece(i)) * prime;
+    }
+    return h;
+  }
+
+private:
+  enum {
+    ROWS = H + 4,
+    QUEUE_SIZE = 16
+  };
+
+  bool tryMove(const Piece& p, int x, int y)
+  {
+    if(!doesPieceFit(p, x, y)) {
+      return false;
+    }
+    piece_ = p;
+    px_ = x;
+    py_ = y;
+    return true;
+  }
+
+  bool doesPieceFit(const Piece& p, int x, int y) const
+  {
+    if(x + p.getLeftMargin() < 0 || x + 3 - p.getRightMargin() >= W ||
+       y + p.getBottomMargin() < 3) {
+      return false;
+    }
+    for(int r = 0; r < 4; ++r) {
+      RowBits bits = p.getRowBits(r);
+      if(bits && (rows_[y-r] & (Word) shiftRow(bits, x))) {
+        return false;
+      }
+    }
+    return true;
+  }
+
+  void placePiece(const Piece& p, int x, int y)
+  {
+    for(int r = 0; r < 4; ++r) {
+      RowBits bits = p.getRowBits(r);
+      if(bits) {
+        rows_[y-r] |= (Word) shiftRow(bits, x);
+        for(int c = 0; c < 4; ++c) {
+          if(bits & (1 << c)) {
+            colours_[y-r][x+c] = p.getColourIndex();
+          }
+        }
+        row_fill_[y-r] += __builtin_popcountll(bits);
+      }
+    }
+
+    for(int c = 0; c < 4; ++c) {
+      int top = p.getColumnTop(c);
+      if(top < 4 && y - top + 1 > heights_[x+c]) {
+        height_sum_ += y - top + 1 - heights_[x+c];
+        heights_[x+c] = y - top + 1;
+      }
+    }
+    cells_ += 4;
+  }
+
+  int collapse(int y)
+  {
+    // The board is small enough to compact by copying: surviving rows
+    // up to the top of the stack slide down over the full ones, and
+    // the rows left at the top are blanked.
+    int first = std::max(y - 3, 0);
+    int last = std::min(y, ROWS - 1);
+
+    int r = first;
+    while(r <= last && row_fill_[r] != W) {
+      ++r;
+    }
+    if(r > last) {
+      return 0;
+    }
+
+    int stack = *std::max_element(heights_, heights_ + W);
+    int removed = 0;
+    int dst = r;
+    for(; r < stack; ++r) {
+      if(r <= last && row_fill_[r] == W) {
+        ++removed;
+        continue;
+      }
+      rows_[dst] = rows_[r];
+      row_fill_[dst] = row_fill_[r];
+      std::memcpy(colours_[dst], colours_[r], W);
+      ++dst;
+    }
+    for(; dst < stack; ++dst) {
+      rows_[dst] = 0;
+      row_fill_[dst] = 0;
+      std::memset(colours_[dst], -1, W);
+    }
+
+    for(int c = 0; c < W; ++c) {
+      int h = heights_[c] - removed;
+      Word bit = (Word) 1 << c;
+      while(h > 0 && !(rows_[h-1] & bit)) {
+        --h;
+      }
+      height_sum_ += h - heights_[c];
+      heights_[c] = h;
+    }
+    cells_ -= removed * W;
+
+    return removed;
+  }
+
+  int landingRow(const Piece& p, int x) const
+  {
+    int y = 3 - p.getBottomMargin();
+    for(int c = 0; c < 4; ++c) {
+      int bottom = p.getColumnBottom(c);
+      if(bottom >= 0) {
+        y = std::max(y, heights_[x+c] + bottom);
+      }
+    }
+    return y;
+  }
+
+  // The same dealing as Game, draw for draw.
+  void refillQueue()
+  {
+    signed char batch[NUM_PIECES];
+
+    if(randomizer_ == Game::RANDOM_BAG) {
+      for(int i = 0; i < NUM_PIECES; ++i) {
+        batch[i] = i;
+      }
+      for(int i = NUM_PIECES - 1; i > 0; --i) {
+        std::swap(batch[i], batch[rng_.below(i + 1)]);
+      }
+    } else {
+      for(int i = 0; i < NUM_PIECES; ++i) {
+        batch[i] = rng_.below(NUM_PIECES);
+      }
+    }
+
+    for(int i = 0; i < NUM_PIECES; ++i) {
+      queue_[ (queue_head_ + queue_count_) % QUEUE_SIZE ] = batch[i];
+      ++queue_count_;
+    }
+  }
+
+  void generateNewPiece()
+  {
+    if(queue_count_ <= PREVIEW_SIZE) {
+      refillQueue();
+    }
+    piece_ = Piece(queue_[queue_head_]);
+    queue_head_ = (queue_head_ + 1) % QUEUE_SIZE;
+    --queue_count_;
+    ++pieces_;
+
+    px_ = (W - 3) / 2;
+    py_ = H + piece_.getSpawnOffset();
+  }
+
+  // The hot state first: everything a move or a fit test reads.
+  Piece piece_;
+  int px_;
+  int py_;
+  bool stopped_;
+  Word rows_[ROWS];
+
+  short heights_[W];
+  unsigned char row_fill_[ROWS];
+  int height_sum_;
+  int cells_;
+  long pieces_;
+
+  Rng rng_;
+  Randomizer randomizer_;
+  signed char queue_[QUEUE_SIZE];
+  int queue_head_;
+  int queue_count_;
+
+  signed char colours_[ROWS][W];
+};
+
+#endif // BASICGAME_H
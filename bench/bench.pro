@@ -0,0 +1,13 @@
+######################################################################
+# Micro-benchmarks for the engine - drives Game without Qt
+######################################################################
+
+TEMPLATE = app
+TARGET = bench
+CONFIG += console c++14 release
+CONFIG -= qt app_bundle
+INCLUDEPATH += ..
+
+# Input
+HEADERS += ../autoplayer.h ../game.h ../movegen.h ../pieces.h ../rng.h
+SOURCES += main.cpp ../autoplayer.cpp ../game.cpp ../movegen.cpp
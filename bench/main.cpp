@@ -0,0 +1,484 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * Micro-benchmarks for the engine's hot paths.  Every benchmark runs
+ * on positions set up from fixed seeds, is warmed up, then timed over
+ * a number of samples; the table gives the median and spread per
+ * operation, and --json writes the same numbers in a form that can be
+ * kept and compared across builds.
+ */
+
+#include "autoplayer.h"
+#include "game.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <functional>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+struct Options
+{
+    int width;
+    int height;
+    unsigned long long seed;
+    int samples;
+    double sampleSeconds;
+    double warmupSeconds;
+    const char *filter;
+    const char *json;
+};
+
+// One benchmark: body(n) does the operation n times.
+struct Benchmark
+{
+    string name;
+    function<void(long)> body;
+};
+
+struct Result
+{
+    string name;
+    long iterations;        // per sample
+    vector<double> ns;      // per operation, one per sample
+    double median;
+    double mean;
+    double stddev;
+    double min;
+    double max;
+};
+
+// Results the compiler must not throw away
+static volatile unsigned long long sink;
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [--width N] [--height N] [--seed N] [--samples N]\n"
+            "          [--sample-ms N] [--warmup-ms N] [--filter TEXT]\n"
+            "          [--json FILE]\n",
+            argv0);
+    exit(1);
+}
+
+static Options parseOptions(int argc, char *argv[])
+{
+    Options opt;
+    opt.width = 10;
+    opt.height = 24;
+    opt.seed = 1;
+    opt.samples = 15;
+    opt.sampleSeconds = 0.02;
+    opt.warmupSeconds = 0.1;
+    opt.filter = 0;
+    opt.json = 0;
+
+    for (int i=1; i<argc; i++)
+    {
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+        }
+        const char *arg = argv[i];
+        const char *val = argv[++i];
+
+        if (!strcmp(arg, "--width"))
+            opt.width = atoi(val);
+        else if (!strcmp(arg, "--height"))
+            opt.height = atoi(val);
+        else if (!strcmp(arg, "--seed"))
+            opt.seed = strtoull(val, 0, 10);
+        else if (!strcmp(arg, "--samples"))
+            opt.samples = atoi(val);
+        else if (!strcmp(arg, "--sample-ms"))
+            opt.sampleSeconds = atof(val) / 1000;
+        else if (!strcmp(arg, "--warmup-ms"))
+            opt.warmupSeconds = atof(val) / 1000;
+        else if (!strcmp(arg, "--filter"))
+            opt.filter = val;
+        else if (!strcmp(arg, "--json"))
+            opt.json = val;
+        else
+            usage(argv[0]);
+    }
+
+    // The positions are built by the autoplayer, which sees 64 columns
+    if (opt.width < 4 || opt.width > 64 || opt.height < 8 ||
+        opt.height > Game::MAX_HEIGHT || opt.samples < 1)
+        usage(argv[0]);
+
+    return opt;
+}
+
+static int stackHeight(const Game& game)
+{
+    int top = 0;
+    for (int c=0; c<game.getWidth(); c++)
+        top = max(top, game.getColumnHeight(c));
+    return top;
+}
+
+// Positions from a game played by the autoplayer, with the stack at a
+// given height.  spawn is the moment a new piece appears; landed is
+// the same piece moved into place, so that the next tick locks it.
+struct Position
+{
+    GameSnapshot spawn;
+    GameSnapshot landed;
+    int cleared;            // rows the lock removes
+};
+
+// Weights that build a tall stack with no holes and never clear a
+// row, to bring the board up to a fill level quickly.
+static AutoPlayer::Weights builderWeights()
+{
+    AutoPlayer::Weights w = AutoPlayer::defaultWeights();
+    w.w[AutoPlayer::FEATURE_HEIGHT] = 0;
+    w.w[AutoPlayer::FEATURE_LINES] = -1;
+    return w;
+}
+
+// Collect count positions with the stack between lo and hi rows before
+// the lock, taking only those whose lock clears rows if clears is set.
+// Games are built up with builderWeights() and played on with the
+// default weights once they reach lo, so rows are nearly full.
+static vector<Position> collectPositions(const Options& opt, int lo, int hi,
+                                         bool clears, int count)
+{
+    vector<Position> positions;
+    Game game(opt.width, opt.height, opt.seed);
+    AutoPlayer builder(builderWeights());
+    AutoPlayer player;
+
+    for (unsigned long long g=0; g<1000 && (int) positions.size()<count; g++)
+    {
+        game.reset(opt.seed + g);
+        for (int t=0; t<10000 && (int) positions.size()<count; t++)
+        {
+            int stack = stackHeight(game);
+            if (stack >= hi)
+                break;
+
+            Position p;
+            game.save(p.spawn);
+            AutoPlayer& mover = stack < lo ? builder : player;
+            if (!mover.play(game))
+                break;
+            game.save(p.landed);
+
+            int result = game.tick();
+            if (result < 0)
+                break;
+            p.cleared = result;
+            if (stack >= lo && (result > 0) == clears)
+                positions.push_back(p);
+        }
+    }
+    if ((int) positions.size() < count)
+    {
+        fprintf(stderr, "only found %d of %d positions for stack %d-%d\n",
+                (int) positions.size(), count, lo, hi);
+    }
+    return positions;
+}
+
+static double secondsSince(Clock::time_point start)
+{
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+static double timeBody(Benchmark& b, long n)
+{
+    Clock::time_point start = Clock::now();
+    b.body(n);
+    return secondsSince(start);
+}
+
+static Result runBenchmark(Benchmark& b, const Options& opt)
+{
+    // Find an iteration count that fills a sample; this doubles as the
+    // start of the warm-up.
+    long n = 1;
+    double seconds;
+    while ((seconds = timeBody(b, n)) < opt.sampleSeconds && n < (1L << 40))
+    {
+        double scale = seconds > 0 ? opt.sampleSeconds / seconds : 100;
+        n = max(n * 2, (long) (n * min(scale * 1.2, 100.0)));
+    }
+
+    Clock::time_point warm = Clock::now();
+    while (secondsSince(warm) < opt.warmupSeconds)
+        b.body(n);
+
+    Result r;
+    r.name = b.name;
+    r.iterations = n;
+    for (int s=0; s<opt.samples; s++)
+        r.ns.push_back(timeBody(b, n) * 1e9 / n);
+
+    vector<double> sorted = r.ns;
+    sort(sorted.begin(), sorted.end());
+    int k = (int) sorted.size();
+    r.median = k % 2 ? sorted[k/2] : (sorted[k/2 - 1] + sorted[k/2]) / 2;
+    r.min = sorted.front();
+    r.max = sorted.back();
+
+    double sum = 0;
+    for (int s=0; s<k; s++)
+        sum += sorted[s];
+    r.mean = sum / k;
+    double var = 0;
+    for (int s=0; s<k; s++)
+        var += (sorted[s] - r.mean) * (sorted[s] - r.mean);
+    r.stddev = k > 1 ? sqrt(var / (k - 1)) : 0;
+    return r;
+}
+
+// Go through positions round robin, restoring each into game before
+// calling op on it.  The restore is part of the time; the "restore"
+// benchmark measures it alone so it can be taken off.
+static function<void(long)> fromPositions(Game& game,
+                                          const vector<Position>& positions,
+                                          bool landed,
+                                          function<unsigned long long(Game&)> op)
+{
+    return [&game, &positions, landed, op](long n) {
+        unsigned long long acc = 0;
+        size_t i = 0;
+        for (long k=0; k<n; k++)
+        {
+            const Position& p = positions[i];
+            game.restore(landed ? p.landed : p.spawn);
+            acc += op(game);
+            if (++i == positions.size())
+                i = 0;
+        }
+        sink = acc;
+    };
+}
+
+static void writeJson(const char *path, const Options& opt,
+                      const vector<Result>& results)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+    {
+        fprintf(stderr, "cannot write %s\n", path);
+        exit(1);
+    }
+
+    char date[64];
+    time_t now = time(0);
+    strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+#ifdef NDEBUG
+    const char *build = "release";
+#else
+    const char *build = "debug";
+#endif
+
+    fprintf(f, "{\n  \"context\": {\n");
+    fprintf(f, "    \"date\": \"%s\",\n", date);
+    fprintf(f, "    \"compiler\": \"%s\",\n", __VERSION__);
+    fprintf(f, "    \"build\": \"%s\",\n", build);
+    fprintf(f, "    \"width\": %d,\n    \"height\": %d,\n", opt.width,
+            opt.height);
+    fprintf(f, "    \"seed\": %llu,\n    \"samples\": %d\n  },\n", opt.seed,
+            opt.samples);
+    fprintf(f, "  \"benchmarks\": [\n");
+    for (size_t i=0; i<results.size(); i++)
+    {
+        const Result& r = results[i];
+        fprintf(f, "    {\"name\": \"%s\", \"iterations\": %ld, "
+                   "\"median_ns\": %.3f, \"mean_ns\": %.3f, "
+                   "\"stddev_ns\": %.3f, \"min_ns\": %.3f, "
+                   "\"max_ns\": %.3f, \"samples_ns\": [",
+                r.name.c_str(), r.iterations, r.median, r.mean, r.stddev,
+                r.min, r.max);
+        for (size_t s=0; s<r.ns.size(); s++)
+            fprintf(f, "%s%.3f", s ? ", " : "", r.ns[s]);
+        fprintf(f, "]}%s\n", i + 1 < results.size() ? "," : "");
+    }
+    fprintf(f, "  ]\n}\n");
+
+    if (fclose(f) != 0)
+    {
+        fprintf(stderr, "cannot write %s\n", path);
+        exit(1);
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt = parseOptions(argc, argv);
+    vector<Benchmark> benchmarks;
+    Game game(opt.width, opt.height, opt.seed);
+
+    // Fill levels, as stack heights in quarters of the well.  The
+    // positions live as long as the benchmarks that use them.
+    const int LEVELS = 4;
+    const int POSITIONS = 64;
+    vector<Position> spawns[LEVELS];
+    vector<Position> clears[LEVELS];
+    for (int l=0; l<LEVELS; l++)
+    {
+        int lo = l * opt.height / LEVELS;
+        int hi = max((l + 1) * opt.height / LEVELS, lo + 1);
+        spawns[l] = collectPositions(opt, lo, hi, false, POSITIONS);
+        if (l > 0)
+            clears[l] = collectPositions(opt, lo, hi, true, POSITIONS);
+    }
+
+    benchmarks.push_back({"reset", [&](long n) {
+        for (long k=0; k<n; k++)
+            game.reset(opt.seed + k);
+        sink = game.getPieceCount();
+    }});
+
+    benchmarks.push_back({"piece/rotateCW", [&](long n) {
+        Piece p[NUM_PIECES];
+        for (int t=0; t<NUM_PIECES; t++)
+            p[t] = Piece(t);
+        for (long k=0; k<n; k++)
+        {
+            int t = k % NUM_PIECES;
+            p[t] = p[t].rotateCW();
+        }
+        unsigned long long acc = 0;
+        for (int t=0; t<NUM_PIECES; t++)
+            acc += p[t].getRotation();
+        sink = acc;
+    }});
+
+    // A piece falling through an empty well: one tick per operation,
+    // with the game restored each time the piece reaches the floor.
+    benchmarks.push_back({"tick/fall", [&](long n) {
+        GameSnapshot start;
+        game.reset(opt.seed);
+        game.save(start);
+        unsigned long long acc = 0;
+        for (long k=0; k<n; k++)
+        {
+            if (!game.doesPieceFit(game.getPiece(), game.getPieceX(),
+                                   game.getPieceY() - 1))
+                game.restore(start);
+            acc += game.tick();
+        }
+        sink = acc;
+    }});
+
+    for (int l=0; l<LEVELS; l++)
+    {
+        if (spawns[l].empty())
+            continue;
+        char name[64];
+        int fill = 100 * l / LEVELS;
+
+        snprintf(name, sizeof(name), "restore/fill=%d%%", fill);
+        benchmarks.push_back({name, fromPositions(game, spawns[l], false,
+            [](Game& g) { return (unsigned long long) g.getPieceY(); })});
+
+        // Every column and rotation, just below the spawn point
+        snprintf(name, sizeof(name), "doesPieceFit/fill=%d%%", fill);
+        const vector<Position> *positions = &spawns[l];
+        benchmarks.push_back({name, [&game, positions](long n) {
+            game.restore((*positions)[0].spawn);
+            int w = game.getWidth();
+            Piece p = game.getPiece();
+            int y = game.getPieceY() - 1;
+            unsigned long long acc = 0;
+            for (long k=0; k<n; k++)
+            {
+                int x = (int) (k % (w + 3)) - 3;
+                Piece q(p.getType(), (int) (k / (w + 3)) & 3);
+                acc += game.doesPieceFit(q, x, y);
+            }
+            sink = acc;
+        }});
+
+        snprintf(name, sizeof(name), "drop/fill=%d%%", fill);
+        benchmarks.push_back({name, fromPositions(game, spawns[l], false,
+            [](Game& g) { return (unsigned long long) g.drop(); })});
+
+        snprintf(name, sizeof(name), "tick/lock/fill=%d%%", fill);
+        benchmarks.push_back({name, fromPositions(game, spawns[l], true,
+            [](Game& g) { return (unsigned long long) g.tick(); })});
+
+        if (!clears[l].empty())
+        {
+            snprintf(name, sizeof(name), "collapse/fill=%d%%", fill);
+            benchmarks.push_back({name, fromPositions(game, clears[l], true,
+                [](Game& g) { return (unsigned long long) g.tick(); })});
+        }
+    }
+
+    // What the window does with every tick, less the GL calls: take the
+    // delta, bring the game thread's copy of the board up to date, copy
+    // it into a frame, and diff that against the renderer's board for
+    // the cells to upload.  The tick itself is included (see tick/fall);
+    // pieces stack up unmoved until the game ends and is reset.
+    benchmarks.push_back({"upload/tick", [&](long n) {
+        int w = game.getWidth();
+        int h = game.getHeight();
+        vector<signed char> cells(w*h, -1), frame;
+        vector<int> shown(w*h, -1), dirty;
+        GameDelta delta;
+        unsigned long long acc = 0;
+        game.reset(opt.seed);
+        for (long k=0; k<n; k++)
+        {
+            if (game.isOver())
+                game.reset();
+            game.tick();
+
+            game.takeDelta(delta);
+            for (size_t d=0; d<delta.cells.size(); d++)
+            {
+                const GameDelta::Cell& cell = delta.cells[d];
+                if (cell.row < h)
+                    cells[cell.row*w + cell.col] = cell.value;
+            }
+            frame = cells;
+
+            dirty.clear();
+            for (int j=0; j<w*h; j++)
+            {
+                if (frame[j] != shown[j])
+                {
+                    shown[j] = frame[j];
+                    dirty.push_back(j);
+                }
+            }
+            acc += dirty.size();
+        }
+        sink = acc;
+    }});
+
+    printf("%-26s %12s %10s %10s %10s %8s\n", "benchmark", "iterations",
+           "median ns", "min ns", "max ns", "cv %");
+    vector<Result> results;
+    for (size_t i=0; i<benchmarks.size(); i++)
+    {
+        if (opt.filter && !strstr(benchmarks[i].name.c_str(), opt.filter))
+            continue;
+        Result r = runBenchmark(benchmarks[i], opt);
+        printf("%-26s %12ld %10.2f %10.2f %10.2f %8.2f\n", r.name.c_str(),
+               r.iterations, r.median, r.min, r.max,
+               r.mean > 0 ? 100 * r.stddev / r.mean : 0.0);
+        fflush(stdout);
+        results.push_back(r);
+    }
+
+    if (opt.json)
+        writeJson(opt.json, opt, results);
+
+    return 0;
+}
@@ -0,0 +1,103 @@
+#include "bufferpool.h"
+#include <algorithm>
+
+BufferPool::BufferPool()
+    : m_gl(0)
+    , m_liveBuffers(0)
+    , m_liveBytes(0)
+    , m_peakBytes(0)
+    , m_allocations(0)
+{
+}
+
+BufferPool::~BufferPool()
+{
+    destroy();
+}
+
+void BufferPool::initialize(QOpenGLFunctions_4_2_Core *gl)
+{
+    m_gl = gl;
+}
+
+BufferPool::Buffer *BufferPool::find(GLuint name)
+{
+    for (size_t i=0; i<m_buffers.size(); i++)
+    {
+        if (m_buffers[i].name == name)
+        {
+            return &m_buffers[i];
+        }
+    }
+    return 0;
+}
+
+GLuint BufferPool::acquire(GLsizeiptr size, GLenum usage, const void *data)
+{
+    // The smallest free buffer of the same usage that is big enough
+    Buffer *best = 0;
+    size_t bestIndex = 0;
+    for (size_t i=0; i<m_free.size(); i++)
+    {
+        Buffer *b = find(m_free[i]);
+        if (b->usage == usage && b->capacity >= size &&
+            (!best || b->capacity < best->capacity))
+        {
+            best = b;
+            bestIndex = i;
+        }
+    }
+
+    if (best)
+    {
+        m_free.erase(m_free.begin() + bestIndex);
+        m_gl->glBindBuffer(GL_ARRAY_BUFFER, best->name);
+        if (data)
+        {
+            m_gl->glBufferSubData(GL_ARRAY_BUFFER, 0, size, data);
+        }
+    }
+    else
+    {
+        Buffer b;
+        m_gl->glGenBuffers(1, &b.name);
+        b.capacity = size;
+        b.usage = usage;
+        m_gl->glBindBuffer(GL_ARRAY_BUFFER, b.name);
+        m_gl->glBufferData(GL_ARRAY_BUFFER, size, data, usage);
+        m_buffers.push_back(b);
+        best = &m_buffers.back();
+        m_allocations++;
+    }
+
+    best->live = true;
+    m_liveBuffers++;
+    m_liveBytes += best->capacity;
+    m_peakBytes = std::max(m_peakBytes, m_liveBytes);
+    return best->name;
+}
+
+void BufferPool::release(GLuint buffer)
+{
+    Buffer *b = find(buffer);
+    if (!b || !b->live)
+    {
+        return;
+    }
+    b->live = false;
+    m_liveBuffers--;
+    m_liveBytes -= b->capacity;
+    m_free.push_back(buffer);
+}
+
+void BufferPool::destroy()
+{
+    for (size_t i=0; i<m_buffers.size(); i++)
+    {
+        m_gl->glDeleteBuffers(1, &m_buffers[i].name);
+    }
+    m_buffers.clear();
+    m_free.clear();
+    m_liveBuffers = 0;
+    m_liveBytes = 0;
+}
@@ -0,0 +1,77 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * BufferPool - owns every GL buffer object the renderer uses.  A buffer
+ * handed back with release() keeps its storage and is given out again
+ * by the next acquire() it is big enough for, rather than deleted and
+ * regenerated.  The pool counts the buffers and bytes it has out and
+ * the most it ever had, so a long run can check that GPU memory stays
+ * flat; destroy() deletes everything.
+ *
+ * All calls need the renderer's GL context current.
+ */
+
+#ifndef BUFFERPOOL_H
+#define BUFFERPOOL_H
+
+#include <QOpenGLFunctions_4_2_Core>
+#include <vector>
+
+class BufferPool
+{
+public:
+    BufferPool();
+
+    // Deletes whatever is left; the context must still be current.
+    ~BufferPool();
+
+    // Use gl for every call from now on.
+    void initialize(QOpenGLFunctions_4_2_Core *gl);
+
+    // A GL_ARRAY_BUFFER with room for size bytes and the given usage,
+    // left bound.  data, if given, is uploaded to the start of it.
+    GLuint acquire(GLsizeiptr size, GLenum usage, const void *data = 0);
+
+    // Hand a buffer back for reuse.  0 is ignored.
+    void release(GLuint buffer);
+
+    // Delete every buffer, those out and those free.
+    void destroy();
+
+    // Buffers out now and their storage in bytes, and the most bytes
+    // ever out at once.
+    int liveBuffers() const { return m_liveBuffers; }
+    long liveBytes() const { return m_liveBytes; }
+    long peakBytes() const { return m_peakBytes; }
+
+    // Buffers kept for reuse, and how many acquire() calls had to
+    // generate a new buffer rather than reuse one.
+    int freeBuffers() const { return m_free.size(); }
+    long allocations() const { return m_allocations; }
+
+private:
+    struct Buffer
+    {
+        GLuint name;
+        GLsizeiptr capacity;
+        GLenum usage;
+        bool live;
+    };
+
+    Buffer *find(GLuint name);
+
+    QOpenGLFunctions_4_2_Core *m_gl;
+
+    // Every buffer the pool made, and the names of the free ones.
+    // There are tens, so a scan is fine.
+    std::vector<Buffer> m_buffers;
+    std::vector<GLuint> m_free;
+
+    int m_liveBuffers;
+    long m_liveBytes;
+    long m_peakBytes;
+    long m_allocations;
+};
+
+#endif // BUFFERPOOL_H
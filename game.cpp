@@ -10,171 +10,477 @@
  */
 
 #include <algorithm>
+#include <cassert>
+#include <cstring>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "game.h"
 
-static const Piece PIECES[] = {
-  Piece(
-        ".x.."
-        ".x.."
-        ".x.."
-        ".x..", 0,			1,0,2,0),
-  Piece(
-        "...."
-        ".xx."
-        ".x.."
-        ".x..", 1,			1,1,1,0),
-  Piece(
-        "...."
-        ".xx."
-        "..x."
-        "..x.", 2,			1,1,1,0),
-  Piece(
-        "...."
-        ".x.."
-        ".xx."
-        "..x.", 3,			1,1,1,0),
-  Piece(
-        "...."
-        "..x."
-        ".xx."
-        ".x..", 4,			1,1,1,0),
-  Piece(
-        "...."
-        "xxx."
-        ".x.."
-        "....", 5,			0,1,1,1),
-  Piece(
-        "...."
-        ".xx."
-        ".xx."
-        "....", 6,			1,1,1,1)
+// Margins (left, top, right, bottom) of the seven pieces in their
+// spawn orientation, as they were entered by hand when the pieces were
+// described with runtime Piece objects.  PIECE_TABLE derives these
+// from the descriptions; the check below keeps the two in agreement.
+static constexpr int PIECE_MARGINS[NUM_PIECES][4] = {
+  { 1,0,2,0 },
+  { 1,1,1,0 },
+  { 1,1,1,0 },
+  { 1,1,1,0 },
+  { 1,1,1,0 },
+  { 0,1,1,1 },
+  { 1,1,1,1 }
 };
 
-Piece::Piece(const char *desc, int cindex, 
-              int left, int top, int right, int bottom)
+// Every clockwise rotation used to shuffle the margins as
+// (left, top, right, bottom) <- (bottom, left, top, right).  Check that
+// all 28 generated orientations agree with that rule as well.
+static constexpr bool generatedMarginsMatch()
 {
-  std::copy(desc, desc + 16, desc_);
-  cindex_ = cindex;
-  margins_[0] = left;
-  margins_[1] = top;
-  margins_[2] = right;
-  margins_[3] = bottom;
+  for(int p = 0; p < NUM_PIECES; ++p) {
+    int m[4] = { PIECE_MARGINS[p][0], PIECE_MARGINS[p][1],
+                 PIECE_MARGINS[p][2], PIECE_MARGINS[p][3] };
+    for(int r = 0; r < NUM_ROTATIONS; ++r) {
+      for(int i = 0; i < 4; ++i) {
+        if(PIECE_TABLE.o[p][r].margins[i] != m[i]) {
+          return false;
+        }
+      }
+      int bottom = m[3];
+      m[3] = m[2];
+      m[2] = m[1];
+      m[1] = m[0];
+      m[0] = bottom;
+    }
+  }
+  return true;
 }
 
-Piece::Piece()
-{}
+static_assert(generatedMarginsMatch(),
+              "PIECE_TABLE margins differ from the hand-written ones");
 
-Piece& Piece::operator =(const Piece& other)
+// Lay a piece row mask (columns 0-3 of its box) over a board row with
+// the box's left edge at column x: the piece covers lo in word w and
+// hi in word w+1.  hi is only ever set in a well over 64 columns wide,
+// for a piece that straddles two words.
+static inline void spreadRow(RowBits bits, int x, int& w,
+                             RowBits& lo, RowBits& hi)
 {
-  std::copy(other.desc_, other.desc_ + 16, desc_);
-  std::copy(other.margins_, other.margins_ + 4, margins_);
-  cindex_ = other.cindex_;
+  if(x < 0) {
+    w = 0;
+    lo = bits >> -x;
+    hi = 0;
+    return;
+  }
+  int s = x & 63;
+  w = x >> 6;
+  lo = bits << s;
+  hi = s > 60 ? bits >> (64 - s) : 0;
+}
+
+Game::Game(int width, int height, unsigned long long seed,
+           Randomizer randomizer)
+  : board_width_(width)
+  , board_height_(height)
+  , stopped_(false)
+  , pieces_(0)
+  , rng_(seed)
+  , randomizer_(randomizer)
+  , undo_serial_(0)
+{
+  assert(width >= 1 && width <= MAX_WIDTH);
+  assert(height >= 1 && height <= MAX_HEIGHT);
+  allocate();
+  reset();
+}
+
+Game::Game(const Game& other)
+  : board_width_(other.board_width_)
+  , board_height_(other.board_height_)
+  , undo_serial_(0)
+{
+  allocate();
+  *this = other;
+}
+
+Game& Game::operator=(const Game& other)
+{
+  if(this == &other) {
+    return *this;
+  }
+
+  if(board_width_ != other.board_width_ ||
+     board_height_ != other.board_height_) {
+    delete [] store_;
+    delete [] dirty_;
+    board_width_ = other.board_width_;
+    board_height_ = other.board_height_;
+    allocate();
+  }
+
+  std::memcpy(store_, other.store_, store_size_);
+  State s;
+  other.saveState(s);
+  loadState(s);
+  discardHistory();
   return *this;
 }
 
-int Piece::getLeftMargin() const
+void Game::allocate()
 {
-  return margins_[0];
+  // Rows first, so the 64-bit words are aligned, then the int arrays,
+  // then the colours.
+  int rows = board_height_ + 4;
+  row_words_ = (board_width_ + 63) / 64;
+  int tail = board_width_ - 64*(row_words_ - 1);
+  last_word_ = tail == 64 ? ~0ULL : (1ULL << tail) - 1;
+
+  size_t words = rows * row_words_ * sizeof(RowBits);
+  size_t ints = (board_width_ + 2*rows) * sizeof(int);
+  store_size_ = words + ints + board_width_*rows;
+  store_ = new char[ store_size_ ];
+  rows_ = (RowBits*) store_;
+  heights_ = (int*) (store_ + words);
+  row_index_ = heights_ + board_width_;
+  row_fill_ = row_index_ + rows;
+  colours_ = (signed char*) (row_fill_ + rows);
+
+  dirty_ = new RowBits[ rows * row_words_ ];
+  row_saved_.assign(rows, 0);
 }
 
-int Piece::getTopMargin() const
+void Game::saveState(State& s) const
 {
-  return margins_[1];
+  s.stopped = stopped_;
+  s.pieces = pieces_;
+  s.rng = rng_;
+  s.randomizer = randomizer_;
+  std::memcpy(s.queue, queue_, sizeof(queue_));
+  s.queue_head = queue_head_;
+  s.queue_count = queue_count_;
+  s.piece = piece_;
+  s.px = px_;
+  s.py = py_;
+  s.height_sum = height_sum_;
+  s.cells = cells_;
 }
 
-int Piece::getRightMargin() const
+void Game::loadState(const State& s)
 {
-  return margins_[2];
+  stopped_ = s.stopped;
+  pieces_ = s.pieces;
+  rng_ = s.rng;
+  randomizer_ = s.randomizer;
+  std::memcpy(queue_, s.queue, sizeof(queue_));
+  queue_head_ = s.queue_head;
+  queue_count_ = s.queue_count;
+  piece_ = s.piece;
+  px_ = s.px;
+  py_ = s.py;
+  height_sum_ = s.height_sum;
+  cells_ = s.cells;
 }
 
-int Piece::getBottomMargin() const
+void Game::discardHistory()
 {
-  return margins_[3];
+  undo_.clear();
+  undo_rows_.clear();
+  undo_bits_.clear();
+  undo_colours_.clear();
+  undo_heights_.clear();
+  for(int r = 0; r < board_height_ + 4; ++r) {
+    markRow(r);
+  }
+  delta_cleared_ = 0;
+  delta_locked_ = false;
+  shown_ = false;
 }
 
-int Piece::getColourIndex() const
+void Game::save(GameSnapshot& snapshot) const
 {
-  return cindex_;
+  snapshot.width_ = board_width_;
+  snapshot.height_ = board_height_;
+  snapshot.store_.resize(store_size_);
+  std::memcpy(&snapshot.store_[0], store_, store_size_);
+  saveState(snapshot.state_);
+}
+
+void Game::restore(const GameSnapshot& snapshot)
+{
+  assert(snapshot.width_ == board_width_ &&
+         snapshot.height_ == board_height_);
+  std::memcpy(store_, &snapshot.store_[0], store_size_);
+  loadState(snapshot.state_);
+  discardHistory();
+}
+
+size_t GameSnapshot::getByteSize() const
+{
+  return 2*sizeof(int) + sizeof(Game::State) + store_.size();
+}
+
+void GameSnapshot::toBytes(unsigned char* out) const
+{
+  std::memcpy(out, &width_, sizeof(int));
+  std::memcpy(out + sizeof(int), &height_, sizeof(int));
+  out += 2*sizeof(int);
+  std::memcpy(out, &state_, sizeof(Game::State));
+  out += sizeof(Game::State);
+  std::memcpy(out, store_.data(), store_.size());
+}
+
+bool GameSnapshot::fromBytes(const unsigned char* in, size_t size)
+{
+  size_t header = 2*sizeof(int) + sizeof(Game::State);
+  if(size < header) {
+    return false;
+  }
+
+  int width, height;
+  std::memcpy(&width, in, sizeof(int));
+  std::memcpy(&height, in + sizeof(int), sizeof(int));
+  if(width <= 0 || width > Game::MAX_WIDTH ||
+     height <= 0 || height > Game::MAX_HEIGHT) {
+    return false;
+  }
+
+  // The same layout Game::allocate() uses.
+  int rows = height + 4;
+  int row_words = (width + 63) / 64;
+  size_t words = (size_t) rows * row_words;
+  if(size - header != words*sizeof(RowBits) + (width + 2*rows)*sizeof(int)
+                      + (size_t) width*rows) {
+    return false;
+  }
+
+  // The bytes may come from a damaged or hostile file, so check every
+  // value the game uses as an index before it gets the chance.
+  // The enum and the bool are checked through their raw bytes, as
+  // loading an out-of-range value through their own types is undefined.
+  Game::State state;
+  std::memcpy(&state, in + 2*sizeof(int), sizeof(Game::State));
+  int randomizer = -1;
+  unsigned char stopped;
+  if(sizeof(state.randomizer) == sizeof(int)) {
+    std::memcpy(&randomizer, &state.randomizer, sizeof(int));
+  }
+  std::memcpy(&stopped, &state.stopped, 1);
+  if(stopped > 1 ||
+     state.piece.getType() >= NUM_PIECES ||
+     state.piece.getRotation() >= NUM_ROTATIONS ||
+     (randomizer != Game::RANDOM_UNIFORM &&
+      randomizer != Game::RANDOM_BAG) ||
+     state.queue_head < 0 || state.queue_head >= Game::QUEUE_SIZE ||
+     state.queue_count < 0 || state.queue_count > Game::QUEUE_SIZE) {
+    return false;
+  }
+  for(int i = 0; i < state.queue_count; ++i) {
+    int type = state.queue[ (state.queue_head + i) % Game::QUEUE_SIZE ];
+    if(type < 0 || type >= NUM_PIECES) {
+      return false;
+    }
+  }
+  for(int r = 0; r < 4; ++r) {
+    for(int c = 0; c < 4; ++c) {
+      if(state.piece.isOn(r, c) &&
+         (state.py - r < 0 || state.py - r >= rows ||
+          state.px + c < 0 || state.px + c >= width)) {
+        return false;
+      }
+    }
+  }
+
+  const unsigned char* store = in + header;
+  int tail = width - 64*(row_words - 1);
+  RowBits last_word = tail == 64 ? ~0ULL : (1ULL << tail) - 1;
+  std::vector<int> ints(width + 2*rows);
+  std::memcpy(ints.data(), store + words*sizeof(RowBits),
+              ints.size()*sizeof(int));
+  const int* heights = ints.data();
+  const int* row_index = heights + width;
+  const int* row_fill = row_index + rows;
+  const signed char* colours = (const signed char*)
+    (store + words*sizeof(RowBits) + ints.size()*sizeof(int));
+
+  std::vector<bool> seen(rows, false);
+  for(int r = 0; r < rows; ++r) {
+    RowBits last;
+    std::memcpy(&last, store + ((size_t) (r+1)*row_words - 1)*sizeof(RowBits),
+                sizeof(RowBits));
+    int index = row_index[r];
+    if((last & ~last_word) || row_fill[r] < 0 || row_fill[r] > width ||
+       index < 0 || index >= rows || seen[index]) {
+      return false;
+    }
+    seen[index] = true;
+  }
+  for(int c = 0; c < width; ++c) {
+    if(heights[c] < 0 || heights[c] > rows) {
+      return false;
+    }
+  }
+  for(size_t i = 0; i < (size_t) width*rows; ++i) {
+    if(colours[i] < -1 || colours[i] >= NUM_PIECES) {
+      return false;
+    }
+  }
+
+  width_ = width;
+  height_ = height;
+  state_ = state;
+  store_.assign(in + header, in + size);
+  return true;
 }
 
-Piece Piece::rotateCW() const
+unsigned long long Game::getChecksum() const
 {
-  char ndesc[16];
-  getColumnRev(0, (char*)ndesc);
-  getColumnRev(1, (char*)(ndesc+4));
-  getColumnRev(2, (char*)(ndesc+8));
-  getColumnRev(3, (char*)(ndesc+12));
+  // FNV-1a over the observable state.
+  unsigned long long h = 0xCBF29CE484222325ULL;
+  const unsigned long long prime = 0x100000001B3ULL;
 
-  return Piece(ndesc, cindex_,
-		margins_[3], margins_[0], margins_[1], margins_[2]);
+  for(int r = 0; r < board_height_ + 4; ++r) {
+    for(int c = 0; c < board_width_; ++c) {
+      h = (h ^ (unsigned char) get(r, c)) * prime;
+    }
+  }
+  int extra[] = { piece_.getType(), piece_.getRotation(), px_, py_,
+                  (int) pieces_, stopped_ };
+  for(int i = 0; i < 6; ++i) {
+    h = (h ^ (unsigned) extra[i]) * prime;
+  }
+  for(int i = 0; i < PREVIEW_SIZE; ++i) {
+    h = (h ^ (unsigned) getNextPiece(i)) * prime;
+  }
+  return h;
 }
 
-Piece Piece::rotateCCW() const
+void Game::pushUndo()
 {
-  char ndesc[16];
-  getColumn(3, (char*)ndesc);
-  getColumn(2, (char*)(ndesc+4));
-  getColumn(1, (char*)(ndesc+8));
-  getColumn(0, (char*)(ndesc+12));
+  UndoFrame frame;
+  saveState(frame.state);
+  frame.rows = undo_rows_.size();
+  frame.serial = ++undo_serial_;
+  undo_.push_back(frame);
+  undo_heights_.insert(undo_heights_.end(), heights_, heights_ + board_width_);
+}
 
-  return Piece(ndesc, cindex_,
-		margins_[1], margins_[2], margins_[3], margins_[0]);
+bool Game::popUndo()
+{
+  if(undo_.empty()) {
+    return false;
+  }
+
+  // Put back the saved rows newest first, so a row saved more than
+  // once ends up as it was when the state was remembered.
+  const UndoFrame& frame = undo_.back();
+  for(size_t i = undo_rows_.size(); i-- > frame.rows; ) {
+    const UndoRow& u = undo_rows_[i];
+    std::copy(&undo_bits_[i*row_words_], &undo_bits_[i*row_words_] + row_words_,
+              rows_ + u.row*row_words_);
+    row_fill_[u.row] = u.fill;
+    std::memcpy(colours_ + row_index_[u.row]*board_width_,
+                &undo_colours_[i*board_width_], board_width_);
+    markRow(u.row);
+  }
+  undo_rows_.resize(frame.rows);
+  undo_bits_.resize(frame.rows * row_words_);
+  undo_colours_.resize(frame.rows * board_width_);
+
+  std::copy(undo_heights_.end() - board_width_, undo_heights_.end(),
+            heights_);
+  undo_heights_.resize(undo_heights_.size() - board_width_);
+
+  // The falling piece may come back as a different one: repaint where
+  // the last delta showed it, and show the restored one afresh.
+  if(shown_) {
+    markCells(shown_piece_, shown_x_, shown_y_, 0, 0, 0);
+    shown_ = false;
+  }
+
+  loadState(frame.state);
+  undo_.pop_back();
+  return true;
 }
 
-bool Piece::isOn(int row, int col) const
+void Game::saveRow(int r)
 {
-  return desc_[ row*4 + col ] == 'x';
+  if(undo_.empty() || row_saved_[r] == undo_.back().serial) {
+    return;
+  }
+  row_saved_[r] = undo_.back().serial;
+
+  UndoRow u;
+  u.row = r;
+  u.fill = row_fill_[r];
+  undo_rows_.push_back(u);
+  undo_bits_.insert(undo_bits_.end(), rows_ + r*row_words_,
+                    rows_ + (r+1)*row_words_);
+  const signed char* colours = colours_ + row_index_[r]*board_width_;
+  undo_colours_.insert(undo_colours_.end(), colours, colours + board_width_);
 }
 
-void Piece::getColumn(int col, char *buf) const
+void Game::markRow(int r)
 {
-  buf[0] = desc_[col];
-  buf[1] = desc_[col+4];
-  buf[2] = desc_[col+8];
-  buf[3] = desc_[col+12];
+  RowBits* dirty = dirty_ + r*row_words_;
+  std::fill(dirty, dirty + row_words_ - 1, ~0ULL);
+  dirty[row_words_ - 1] = last_word_;
 }
 
-void Piece::getColumnRev(int col, char *buf) const
+void Game::reset(unsigned long long seed)
 {
-  buf[0] = desc_[col+12];
-  buf[1] = desc_[col+8];
-  buf[2] = desc_[col+4];
-  buf[3] = desc_[col];
+  rng_.reseed(seed);
+  reset();
 }
 
-Game::Game(int width, int height)
-  : board_width_(width)
-  , board_height_(height)
-  , stopped_(false)
+void Game::setRandomizer(Randomizer randomizer)
 {
-  int sz = board_width_ * (board_height_+4);
+  randomizer_ = randomizer;
+}
 
-  board_ = new int[ sz ];
-  std::fill(board_, board_ + sz, -1);
-  generateNewPiece();
+int Game::getNextPiece(int i) const
+{
+  return queue_[ (queue_head_ + i) % QUEUE_SIZE ];
 }
 
 void Game::reset()
 {
   stopped_ = false;
-  std::fill(board_, board_ + (board_width_*(board_height_+4)), -1);
+  pieces_ = 0;
+  queue_head_ = 0;
+  queue_count_ = 0;
+  std::fill(rows_, rows_ + (board_height_+4)*row_words_, 0);
+  for(int r = 0; r < board_height_ + 4; ++r) {
+    row_index_[r] = r;
+  }
+  std::fill(colours_, colours_ + (board_width_*(board_height_+4)), -1);
+  std::fill(heights_, heights_ + board_width_, 0);
+  std::fill(row_fill_, row_fill_ + board_height_+4, 0);
+  height_sum_ = 0;
+  cells_ = 0;
+  discardHistory();
   generateNewPiece();
 }
 
 Game::~Game()
 {
-  delete [] board_;
+  delete [] store_;
+  delete [] dirty_;
 }
 
 int Game::get(int r, int c) const
 {
-  return board_[ r*board_width_ + c ];
+  int br = py_ - r;
+  int bc = c - px_;
+  if(br >= 0 && br < 4 && bc >= 0 && bc < 4 && piece_.isOn(br, bc)) {
+    return piece_.getColourIndex();
+  }
+  return colours_[ row_index_[r]*board_width_ + c ];
 }
 
-int& Game::get(int r, int c) 
+void Game::set(int r, int c, int v)
 {
-  return board_[ r*board_width_ + c ];
+  colours_[ row_index_[r]*board_width_ + c ] = v;
 }
 
 bool Game::doesPieceFit(const Piece& p, int x, int y) const
@@ -192,11 +498,14 @@ bool Game::doesPieceFit(const Piece& p, int x, int y) const
   }
 
   for(int r = 0; r < 4; ++r) {
-    for(int c = 0; c < 4; ++c) {
-      if(p.isOn(r, c)) {
-        if(get(y-r, x+c) != -1) {
-          return false;
-        }
+    RowBits bits = p.getRowBits(r);
+    if(bits) {
+      int w;
+      RowBits lo, hi;
+      spreadRow(bits, x, w, lo, hi);
+      const RowBits* row = rows_ + (y-r)*row_words_ + w;
+      if((row[0] & lo) || (hi && (row[1] & hi))) {
+        return false;
       }
     }
   }
@@ -204,87 +513,293 @@ bool Game::doesPieceFit(const Piece& p, int x, int y) const
   return true;
 }
 
-void Game::removePiece(const Piece& p, int x, int y) 
+int Game::collapse(int y)
 {
-  for(int r = 0; r < 4; ++r) {
-    for(int c = 0; c < 4; ++c) {
-      if(p.isOn(r, c)) {
-        get(y-r, x+c) = -1;
-      }
-    }
+  // Only the rows under the piece that just landed can have been
+  // completed, and the fill counts say which without looking at the
+  // cells.  Find the lowest, then compact everything up to the top of
+  // the stack in one pass: surviving rows slide down by the number of
+  // full rows seen so far, and the colour rows of the removed ones are
+  // recycled, blanked, as the new empty rows at the top.  Rows above
+  // the stack are empty and stay where they are.
+
+  int stack = 0;
+  for(int c = 0; c < board_width_; ++c) {
+    stack = std::max(stack, heights_[c]);
   }
-}
+  int first = std::max(y - 3, 0);
+  int last = std::min(y, stack - 1);
+  int words = row_words_;
 
-void Game::removeRow(int y)
-{
-  for(int r = y + 1; r < board_height_ + 4; ++r) {
-    for(int c = 0; c < board_width_; ++c) {
-      get(r-1, c) = get(r, c);
-    }
+  int r = first;
+  while(r <= last && row_fill_[r] != board_width_) {
+    ++r;
   }
-
-  for(int c = 0; c < board_width_; ++c) {
-    get(board_height_+3, c) = -1;
+  if(r > last) {
+    return 0;
   }
-}
 
-int Game::collapse() 
-{
-  // This method is implemented in a brain-dead way.  Repeatedly
-  // walk up from the bottom of the well, removing the first full 
-  // row, stopping when there are no more full rows.  It could be
-  // made much faster.  Sue me.
+  // Every row from the lowest full one up to the top of the stack
+  // changes: mark what is there now and, below, what lands there.
+  int lowest = r;
+  for(int i = lowest; i < stack; ++i) {
+    saveRow(i);
+  }
+  for(int i = lowest*words; i < stack*words; ++i) {
+    dirty_[i] |= rows_[i];
+  }
 
+  int freed[4];
   int removed = 0;
+  int highest = r;
+  int dst = r;
 
-  while(true) {
-    bool got_one = false;
-    for(int r = 0; r < board_height_ + 4; ++r) {
-      int holes = 0;
+  for(; r <= last; ++r) {
+    if(row_fill_[r] == board_width_) {
+      freed[removed++] = row_index_[r];
+      highest = r;
+    } else {
+      std::copy(rows_ + r*words, rows_ + (r+1)*words, rows_ + dst*words);
+      row_index_[dst] = row_index_[r];
+      row_fill_[dst] = row_fill_[r];
+      ++dst;
+    }
+  }
 
-      for(int c = 0; c < board_width_; ++c) {
-        if(get(r, c) == -1) {
-          holes = 1;
-          break;
-        }
-      }
+  std::copy(rows_ + r*words, rows_ + stack*words, rows_ + dst*words);
+  std::copy(row_index_ + r, row_index_ + stack, row_index_ + dst);
+  std::copy(row_fill_ + r, row_fill_ + stack, row_fill_ + dst);
+  dst += stack - r;
+
+  std::fill(rows_ + dst*words, rows_ + stack*words, 0);
+  for(int i = 0; i < removed; ++i, ++dst) {
+    row_index_[dst] = freed[i];
+    row_fill_[dst] = 0;
+    std::fill(colours_ + freed[i]*board_width_,
+              colours_ + (freed[i]+1)*board_width_, -1);
+  }
 
-      if(holes == 0) {
-        got_one = 1;
-        ++removed;
-        removeRow(r);
-        break;
-      }
+  // Every full row crosses every column, so each column top is at or
+  // above the highest removed row.  Tops above it come down by exactly
+  // the number of rows removed; a top in that row was removed itself,
+  // and only those columns are walked down to their new top.
+  int exposed = highest + 1;
+  int c = 0;
+  height_sum_ -= removed * board_width_;
+#ifdef __SSE2__
+  const __m128i drop = _mm_set1_epi32(removed);
+  const __m128i gone = _mm_set1_epi32(exposed);
+  for(; c + 4 <= board_width_; c += 4) {
+    __m128i h = _mm_loadu_si128((const __m128i*)(heights_ + c));
+    int walk = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpeq_epi32(h, gone)));
+    _mm_storeu_si128((__m128i*)(heights_ + c), _mm_sub_epi32(h, drop));
+    while(walk) {
+      settleColumn(c + __builtin_ctz(walk));
+      walk &= walk - 1;
     }
-
-    if(!got_one) {
-      break;
+  }
+#endif
+  for(; c < board_width_; ++c) {
+    heights_[c] -= removed;
+    if(heights_[c] + removed == exposed) {
+      settleColumn(c);
     }
   }
+  cells_ -= removed * board_width_;
+
+  for(int i = lowest*words; i < (stack - removed)*words; ++i) {
+    dirty_[i] |= rows_[i];
+  }
+  delta_cleared_ += removed;
 
   return removed;
 }
 
+void Game::settleColumn(int c)
+{
+  int h = heights_[c];
+  const RowBits* word = rows_ + (c >> 6);
+  RowBits bit = 1ULL << (c & 63);
+  while(h > 0 && !(word[(h-1)*row_words_] & bit)) {
+    --h;
+  }
+  height_sum_ += h - heights_[c];
+  heights_[c] = h;
+}
+
 void Game::placePiece(const Piece& p, int x, int y)
 {
   for(int r = 0; r < 4; ++r) {
-    for(int c = 0; c < 4; ++c) {
-      if(p.isOn(r, c)) {
-        get(y-r, x+c) = p.getColourIndex();
+    RowBits bits = p.getRowBits(r);
+    if(bits) {
+      int w;
+      RowBits lo, hi;
+      spreadRow(bits, x, w, lo, hi);
+      saveRow(y-r);
+      RowBits* row = rows_ + (y-r)*row_words_ + w;
+      row[0] |= lo;
+      if(hi) {
+        row[1] |= hi;
       }
+      for(int c = 0; c < 4; ++c) {
+        if(bits & (1 << c)) {
+          set(y-r, x+c, p.getColourIndex());
+        }
+      }
+      row_fill_[y-r] += __builtin_popcountll(bits);
+    }
+  }
+
+  // From here on the cells are part of the board: settle up with
+  // wherever the piece was last shown.
+  markPiece();
+  shown_ = false;
+  delta_locked_ = true;
+
+  for(int c = 0; c < 4; ++c) {
+    int top = p.getColumnTop(c);
+    if(top < 4 && y - top + 1 > heights_[x+c]) {
+      height_sum_ += y - top + 1 - heights_[x+c];
+      heights_[x+c] = y - top + 1;
+    }
+  }
+  cells_ += 4;
+}
+
+int Game::landingRow(const Piece& p, int x) const
+{
+  // The lowest box row at which every column of the piece clears the
+  // top of the stack under it, or the floor.
+  int y = 3 - p.getBottomMargin();
+  for(int c = 0; c < 4; ++c) {
+    int bottom = p.getColumnBottom(c);
+    if(bottom >= 0) {
+      y = std::max(y, heights_[x+c] + bottom);
     }
   }
+  return y;
 }
 	
+void Game::refillQueue()
+{
+  signed char batch[NUM_PIECES];
+
+  if(randomizer_ == RANDOM_BAG) {
+    for(int i = 0; i < NUM_PIECES; ++i) {
+      batch[i] = i;
+    }
+    for(int i = NUM_PIECES - 1; i > 0; --i) {
+      std::swap(batch[i], batch[rng_.below(i + 1)]);
+    }
+  } else {
+    for(int i = 0; i < NUM_PIECES; ++i) {
+      batch[i] = rng_.below(NUM_PIECES);
+    }
+  }
+
+  for(int i = 0; i < NUM_PIECES; ++i) {
+    queue_[ (queue_head_ + queue_count_) % QUEUE_SIZE ] = batch[i];
+    ++queue_count_;
+  }
+}
+
 void Game::generateNewPiece() 
 {
-  piece_ = PIECES[ rand() % 7 ];
+  // Keep the piece about to be dealt plus a full preview queued.
+  if(queue_count_ <= PREVIEW_SIZE) {
+    refillQueue();
+  }
+  piece_ = Piece(queue_[queue_head_]);
+  queue_head_ = (queue_head_ + 1) % QUEUE_SIZE;
+  --queue_count_;
+  ++pieces_;
 
   int xleft = (board_width_-3) / 2;
 
   px_ = xleft;
-  py_ = board_height_ + 3 - piece_.getBottomMargin();
-  placePiece(piece_, px_, py_);
+  py_ = board_height_ + piece_.getSpawnOffset();
+}
+
+RowBits Game::footprint(const Piece& p, int x, int y, int row, int word)
+{
+  int r = y - row;
+  if(r < 0 || r >= 4) {
+    return 0;
+  }
+  int w;
+  RowBits lo, hi;
+  spreadRow(p.getRowBits(r), x, w, lo, hi);
+  return word == w ? lo : word == w + 1 ? hi : 0;
+}
+
+void Game::markPiece()
+{
+  // A piece keeps its colour, so cells it covers both where it was
+  // shown and where it is now have not changed -- as long as it is the
+  // same piece.
+  bool same = shown_ && shown_piece_.getType() == piece_.getType();
+  markCells(piece_, px_, py_, same ? &shown_piece_ : 0, shown_x_, shown_y_);
+  if(shown_) {
+    markCells(shown_piece_, shown_x_, shown_y_, same ? &piece_ : 0, px_, py_);
+  }
+}
+
+void Game::markCells(const Piece& p, int x, int y,
+                     const Piece* except, int ex, int ey)
+{
+  for(int r = 0; r < 4; ++r) {
+    RowBits bits = p.getRowBits(r);
+    if(!bits) {
+      continue;
+    }
+    int w;
+    RowBits lo, hi;
+    spreadRow(bits, x, w, lo, hi);
+    RowBits* dirty = dirty_ + (y-r)*row_words_;
+    if(except) {
+      lo &= ~footprint(*except, ex, ey, y-r, w);
+      hi &= ~footprint(*except, ex, ey, y-r, w+1);
+    }
+    dirty[w] |= lo;
+    if(hi) {
+      dirty[w+1] |= hi;
+    }
+  }
+}
+
+void Game::takeDelta(GameDelta& delta)
+{
+  bool moved = !shown_ || piece_.getType() != shown_piece_.getType() ||
+    piece_.getRotation() != shown_piece_.getRotation() ||
+    px_ != shown_x_ || py_ != shown_y_;
+  markPiece();
+  shown_ = true;
+  shown_piece_ = piece_;
+  shown_x_ = px_;
+  shown_y_ = py_;
+
+  delta.cells.clear();
+  for(int r = 0; r < board_height_ + 4; ++r) {
+    for(int w = 0; w < row_words_; ++w) {
+      RowBits& m = dirty_[r*row_words_ + w];
+      while(m) {
+        int c = w*64 + __builtin_ctzll(m);
+        m &= m - 1;
+
+        GameDelta::Cell cell;
+        cell.row = r;
+        cell.col = c;
+        cell.value = get(r, c);
+        delta.cells.push_back(cell);
+      }
+    }
+  }
+
+  delta.rowsCleared = delta_cleared_;
+  delta.pieceMoved = moved;
+  delta.pieceLocked = delta_locked_;
+  delta_cleared_ = 0;
+  delta_locked_ = false;
 }
 
 int Game::tick()
@@ -293,7 +808,6 @@ int Game::tick()
     return -1;
   }
 
-  removePiece(piece_, px_, py_);
   int ny = py_ - 1;
 
   if(!doesPieceFit(piece_, px_, ny)) {
@@ -304,12 +818,11 @@ int Game::tick()
       stopped_ = true;
       return -1;
     } else {
-      int rm = collapse();
+      int rm = collapse(py_);
       generateNewPiece();
       return rm;
     }
   } else {
-    placePiece(piece_, px_, ny);
     py_ = ny;
     return 0;
   }
@@ -317,56 +830,43 @@ int Game::tick()
 
 bool Game::moveLeft()
 {
-  // Most of the piece movement methods work like this:
-  //  1. remove the piece from the board.
-  // 	2. does the piece fit in its new configuration?
-  //	3a. if yes, add it to the board in its new configuration.
-  //	3b. if no, put it back where it was.
-  // Simple and sort of silly, but satisfactory.
+  // The falling piece is not part of the board, so every movement
+  // method is just: does the piece fit in its new configuration?  If
+  // so, that is where it is now.
 
   int nx = px_ - 1;
 
-  removePiece(piece_, px_, py_);
   if(doesPieceFit(piece_, nx, py_)) {
-    placePiece(piece_, nx, py_);
     px_ = nx;
     return true;
-  } else {
-    placePiece(piece_, px_, py_);
-    return false;
   }
+  return false;
 }
 
 bool Game::moveRight()
 {
   int nx = px_ + 1;
 
-  removePiece(piece_, px_, py_);
   if(doesPieceFit(piece_, nx, py_)) {
-    placePiece(piece_, nx, py_);
     px_ = nx;
     return true;
-  } else {
-    placePiece(piece_, px_, py_);
-    return false;
   }
+  return false;
 }
 
 bool Game::drop()
 {
-  removePiece(piece_, px_, py_);
-  int ny = py_;
-
-  while(true) {
-    --ny;
-    if(!doesPieceFit(piece_, px_, ny)) {
-      break;
+  // Everything above the skyline is empty, so a piece wholly above it
+  // falls straight onto it.  One tucked under an overhang has to be
+  // walked down the old way.
+  int ny = landingRow(piece_, px_);
+  if(ny > py_) {
+    ny = py_;
+    while(doesPieceFit(piece_, px_, ny - 1)) {
+      --ny;
     }
   }
 
-  ++ny;
-  placePiece(piece_, px_, ny);
-	
   if(ny == py_) {
     return false;
   } else {
@@ -377,28 +877,50 @@ bool Game::drop()
 
 bool Game::rotateCW() 
 {
-  removePiece(piece_, px_, py_);
   Piece npiece = piece_.rotateCW();
   if(doesPieceFit(npiece, px_, py_)) {
-    placePiece(npiece, px_, py_);
     piece_ = npiece;
     return true;
-  } else {
-    placePiece(piece_, px_, py_);
-    return false;
   }
+  return false;
 }
 
 bool Game::rotateCCW() 
 {
-  removePiece(piece_, px_, py_);
   Piece npiece = piece_.rotateCCW();
   if(doesPieceFit(npiece, px_, py_)) {
-    placePiece(npiece, px_, py_);
     piece_ = npiece;
     return true;
-  } else {
-    placePiece(piece_, px_, py_);
-    return false;
   }
+  return false;
+}
+
+bool Game::moveDown()
+{
+  int ny = py_ - 1;
+
+  if(doesPieceFit(piece_, px_, ny)) {
+    py_ = ny;
+    return true;
+  }
+  return false;
+}
+
+bool Game::apply(Move move)
+{
+  switch(move) {
+  case MOVE_LEFT:
+    return moveLeft();
+  case MOVE_RIGHT:
+    return moveRight();
+  case MOVE_CW:
+    return rotateCW();
+  case MOVE_CCW:
+    return rotateCCW();
+  case MOVE_DOWN:
+    return moveDown();
+  case MOVE_DROP:
+    return drop();
+  }
+  return false;
 }
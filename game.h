@@ -12,47 +12,223 @@
 #ifndef GAME_H
 #define GAME_H
 
+#include <cstddef>
+#include <vector>
+
+#include "pieces.h"
+#include "rng.h"
+
+// Occupancy of 64 columns of one row of the well, one bit per column
+// (bit c is column c).  Wider wells keep several words per row; see
+// Game::getRowWords().
+typedef unsigned long long RowBits;
+
+// Shift a piece row mask (columns 0-3 of the piece) so that it lines
+// up with the well when the piece's left edge is at column x.  x may
+// be negative as long as the shifted-out columns are empty.
+inline RowBits shiftRow(RowBits bits, int x)
+{
+  return x >= 0 ? bits << x : bits >> -x;
+}
+
+// A piece is just an index into PIECE_TABLE: which of the seven
+// shapes it is and which of its four orientations.  Rotating only
+// changes the orientation index; no description is copied.
 class Piece {
 public:
-  Piece();
-  Piece(const char *desc, int cindex, 
-         int left, int top, int right, int bottom);
+  constexpr Piece()
+    : type_(0), rot_(0)
+  {}
+  constexpr Piece(int type, int rotation = 0)
+    : type_(type), rot_(rotation & 3)
+  {}
 
-  Piece& operator =(const Piece& other);
+  int getLeftMargin() const
+  {
+    return shape().margins[0];
+  }
+  int getTopMargin() const
+  {
+    return shape().margins[1];
+  }
+  int getRightMargin() const
+  {
+    return shape().margins[2];
+  }
+  int getBottomMargin() const
+  {
+    return shape().margins[3];
+  }
 
-  int getLeftMargin() const;
-  int getTopMargin() const;
-  int getRightMargin() const;
-  int getBottomMargin() const;
-  int getColourIndex() const;
+  // The shape index doubles as the colour index.
+  int getColourIndex() const
+  {
+    return type_;
+  }
+  int getType() const
+  {
+    return type_;
+  }
+  int getRotation() const
+  {
+    return rot_;
+  }
+
+  // Highest and lowest filled row of column col of the 4x4 box (4 and
+  // -1 respectively if the column is empty).
+  int getColumnTop(int col) const
+  {
+    return shape().tops[col];
+  }
+  int getColumnBottom(int col) const
+  {
+    return shape().bottoms[col];
+  }
+
+  // Offset from the top of the well (board height) of the row at
+  // which a freshly spawned piece in this orientation sits.
+  int getSpawnOffset() const
+  {
+    return shape().spawn;
+  }
+
+  constexpr Piece rotateCW() const
+  {
+    return Piece(type_, rot_ + 1);
+  }
+  constexpr Piece rotateCCW() const
+  {
+    return Piece(type_, rot_ + 3);
+  }
 
-  Piece rotateCW() const;
-  Piece rotateCCW() const;
+  bool isOn(int row, int col) const
+  {
+    return (shape().mask >> (row*4 + col)) & 1;
+  }
 
-  bool isOn(int row, int col) const;
+  // Occupancy of row `row' of the 4x4 description as a bit mask, with
+  // bit c set when column c is on.
+  RowBits getRowBits(int row) const
+  {
+    return shape().bits[row];
+  }
 
 private:
-  void getColumn(int col, char *buf) const;
-  void getColumnRev(int col, char *buf) const;
+  const PieceOrientation& shape() const
+  {
+    return PIECE_TABLE.o[type_][rot_];
+  }
+
+  unsigned char type_;
+  unsigned char rot_;
+};
+
+class GameSnapshot;
+
+// What changed on the board between two calls to Game::takeDelta():
+// every cell whose get() value is now different, with its new value,
+// and a summary of what caused the changes.  A cell that changed and
+// changed back may or may not be listed.
+struct GameDelta
+{
+  struct Cell
+  {
+    short row;
+    short col;
+    signed char value;
+  };
 
-  char desc_[16];
-  int cindex_;
-  int margins_[4];
+  std::vector<Cell> cells;
+  int rowsCleared;
+  bool pieceMoved;
+  bool pieceLocked;
 };
 
 class Game
 {
 public:
+  // How new pieces are chosen.  RANDOM_UNIFORM draws every piece
+  // independently; RANDOM_BAG deals all seven pieces in a shuffled
+  // order before dealing any of them again.
+  enum Randomizer {
+    RANDOM_UNIFORM,
+    RANDOM_BAG
+  };
+
+  // The moves a player can make, for callers that want to make them
+  // by value (bots, replays).  MOVE_DOWN is a single-row soft drop,
+  // MOVE_DROP is drop().
+  enum Move {
+    MOVE_LEFT,
+    MOVE_RIGHT,
+    MOVE_CW,
+    MOVE_CCW,
+    MOVE_DOWN,
+    MOVE_DROP
+  };
+
+  // Number of upcoming pieces visible through getNextPiece().
+  static const int PREVIEW_SIZE = 5;
+
+  // The largest well a game (and a replay of one) can have.
+  static const int MAX_WIDTH = 4096;
+  static const int MAX_HEIGHT = 4096;
+
   // Create a new game instance with a well of the given dimensions.
   // Note that internally, the board has four extra rows, to hold a 
-  // piece that has just begun to fall.
-  Game(int width, int height);
+  // piece that has just begun to fall.  Each game has its own piece
+  // generator; games created with the same seed and randomizer deal
+  // the same pieces.
+  Game(int width, int height, unsigned long long seed = 0,
+       Randomizer randomizer = RANDOM_UNIFORM);
+
+  // A copy is an independent game in the same state.  The undo history
+  // is not copied, and the copy's first delta lists every cell.
+  Game(const Game& other);
+  Game& operator=(const Game& other);
 
   ~Game();
 
+  // Save the whole state of the game, or go back to a state saved from
+  // a game of the same size.  Neither allocates once the snapshot has
+  // been used, so bots can save and restore as often as they like.
+  // Restoring forgets the undo history.
+  void save(GameSnapshot& snapshot) const;
+  void restore(const GameSnapshot& snapshot);
+
+  // pushUndo() remembers the current state; popUndo() goes back to the
+  // most recently remembered one and forgets it, returning false if
+  // there is none.  Remembered states share every board row that has
+  // not changed since: a row is only copied the first time it changes.
+  // reset() forgets them all.
+  void pushUndo();
+  bool popUndo();
+  int getUndoDepth() const
+  {
+    return (int) undo_.size();
+  }
+
+  // A hash of everything a player can observe: every cell, the falling
+  // piece, the preview, the piece count and whether the game is over.
+  // Two games that will play out identically have equal checksums.
+  unsigned long long getChecksum() const;
+
   // Set the game to an initial state -- empty well, one piece waiting
-  // on top.
+  // on top.  The piece generator carries on from where it was; the
+  // second form reseeds it first, making the new game reproducible.
   void reset();
+  void reset(unsigned long long seed);
+
+  // Choose how pieces are generated from the next reset() on.
+  void setRandomizer(Randomizer randomizer);
+  Randomizer getRandomizer() const
+  {
+    return randomizer_;
+  }
+
+  // Type (and colour index) of the i'th piece after the one currently
+  // falling, for i in [0, PREVIEW_SIZE).
+  int getNextPiece(int i) const;
 
   // Advance the game by one tick.  This usually just pushes the 
   // currently falling piece down by one row.  It can sometimes cause
@@ -78,6 +254,44 @@ public:
   bool rotateCW();
   bool rotateCCW();
 
+  // Move the piece down one row.  Unlike tick(), this never locks the
+  // piece in place; it just returns false if the piece cannot move.
+  bool moveDown();
+
+  // Make one of the moves above.  Returns whether it was successful.
+  bool apply(Move move);
+
+  // Whether piece p would fit with its box at (x, y), inside the well
+  // and clear of every settled cell.  Every move is this test first.
+  bool doesPieceFit(const Piece& p, int x, int y) const;
+
+  // The falling piece and the position of its 4x4 box: x is the left
+  // column and y the top row, in the same coordinates as get().
+  const Piece& getPiece() const
+  {
+    return piece_;
+  }
+  int getPieceX() const
+  {
+    return px_;
+  }
+  int getPieceY() const
+  {
+    return py_;
+  }
+
+  bool isOver() const
+  {
+    return stopped_;
+  }
+
+  // Number of pieces dealt since the last reset, including the one
+  // falling now.  Changes exactly when a new piece appears.
+  long getPieceCount() const
+  {
+    return pieces_;
+  }
+
   int getWidth() const
   { 
     return board_width_;
@@ -95,32 +309,238 @@ public:
   // NOTE!  You can (and should) actually call this method with values
   // for r in [0,board_height_+4), not [0,board_height_].  The top four
   // rows are added on to accommodate new pieces that are falling into
-  // the well.
+  // the well.  The falling piece is drawn over the settled cells.
   int get(int r, int c) const;
-  int& get(int r, int c);
+
+  // Occupancy of row r of the settled cells as a bit mask (bit c for
+  // column c).  The falling piece is not included.  This is only the
+  // first 64 columns; getRowWords() has the whole row, as
+  // getRowWordCount() words with column c at bit c%64 of word c/64.
+  RowBits getRowBits(int r) const
+  {
+    return rows_[r*row_words_];
+  }
+  int getRowWordCount() const
+  {
+    return row_words_;
+  }
+  const RowBits* getRowWords(int r) const
+  {
+    return rows_ + r*row_words_;
+  }
+
+  // Features of the settled cells (everything but the falling piece),
+  // kept up to date as pieces lock and rows are removed, so reading
+  // them costs nothing.
+  //   getColumnHeight: one past the highest filled row of column c, or
+  //                    0 for an empty column.
+  //   getHoles:        empty cells below the top of their column.
+  //   getRowFill:      filled cells in row r.
+  int getColumnHeight(int c) const
+  {
+    return heights_[c];
+  }
+  int getHoles() const
+  {
+    return height_sum_ - cells_;
+  }
+  int getRowFill(int r) const
+  {
+    return row_fill_[r];
+  }
+
+  // Fill in the changes since the last call (or since construction),
+  // and start collecting afresh.  After a reset() every cell is listed.
+  void takeDelta(GameDelta& delta);
 
 private:
-  bool doesPieceFit(const Piece& p, int x, int y) const;
+  friend class GameSnapshot;
+
+  // Point the board arrays into store_, which holds them all in one
+  // block so a copy is a single memcpy.
+  void allocate();
+
+  // Copy the current contents of row r into the undo log, if there is
+  // a remembered state and the row has not been copied since.
+  void saveRow(int r);
 
-  void removeRow(int y);
-  int collapse();
+  // List every cell of row r in the next delta.
+  void markRow(int r);
 
-  void removePiece(const Piece& p, int x, int y);
+  // The board has been replaced wholesale: forget the undo history and
+  // list every cell in the next delta.
+  void discardHistory();
+
+  void set(int r, int c, int v);
+
+  // Remove any rows completed by a piece that just landed with its
+  // top row at y, dropping everything above.  Returns the number of
+  // rows removed.
+  int collapse(int y);
+
+  // Merge a piece that has just locked into the settled cells and
+  // their features.  Until then the falling piece lives only in
+  // piece_, px_ and py_, so moving it never touches the board.
   void placePiece(const Piece& p, int x, int y);
 
+  // Row at which the piece would land dropping straight down in column
+  // x, judging by the skyline alone.
+  int landingRow(const Piece& p, int x) const;
+
+  // Occupancy of word `word' of board row `row' by piece p with its
+  // box at (x, y).
+  static RowBits footprint(const Piece& p, int x, int y, int row, int word);
+
+  // Mark the cells the falling piece left or newly covers since the
+  // last takeDelta() showed it.  Moves themselves mark nothing; the
+  // difference is only worked out when it is needed.
+  void markPiece();
+
+  // Mark the cells of piece p at (x, y), less those of `except' at
+  // (ex, ey) if it is given.
+  void markCells(const Piece& p, int x, int y,
+                 const Piece* except, int ex, int ey);
+
+  // Bring column c, whose top cell has just been removed, down to the
+  // highest cell left in it.
+  void settleColumn(int c);
+
   void generateNewPiece();
+  void refillQueue();
 
 private:
   int board_width_;
   int board_height_;
 
   bool stopped_;
+  long pieces_;
+
+  // Upcoming pieces, a ring buffer refilled seven at a time (one bag
+  // or seven independent draws) whenever the preview runs short.
+  enum { QUEUE_SIZE = 16 };
+  Rng rng_;
+  Randomizer randomizer_;
+  signed char queue_[QUEUE_SIZE];
+  int queue_head_;
+  int queue_count_;
 
   Piece piece_;
   int px_;
   int py_;
 
-  int* board_;
+  // Everything above plus the feature totals below, copied as a whole
+  // by snapshots and undo.
+  struct State
+  {
+    bool stopped;
+    long pieces;
+    Rng rng;
+    Randomizer randomizer;
+    signed char queue[QUEUE_SIZE];
+    int queue_head;
+    int queue_count;
+    Piece piece;
+    int px;
+    int py;
+    int height_sum;
+    int cells;
+  };
+  void saveState(State& s) const;
+  void loadState(const State& s);
+
+  // The well is kept as two parallel arrays: an occupancy bitboard
+  // with row_words_ words per row, used for all collision tests, and
+  // the colour index of every cell, only consulted by get().  Colour
+  // rows are reached through row_index_, so removing a row moves an
+  // index instead of copying the cells above it.  last_word_ has the
+  // columns of a row's last word set.
+  int row_words_;
+  RowBits last_word_;
+  RowBits* rows_;
+  int* row_index_;
+  signed char* colours_;
+  char* store_;
+  size_t store_size_;
+
+  // Settled features: column heights and their sum, filled cells per
+  // row and in total.
+  int* heights_;
+  int* row_fill_;
+  int height_sum_;
+  int cells_;
+
+  // Cells of the board changed since the last takeDelta(), laid out
+  // like rows_, and what changed them.
+  // The falling piece is tracked separately: shown_piece_ at
+  // (shown_x_, shown_y_) is where the last delta left it, if shown_.
+  RowBits* dirty_;
+  int delta_cleared_;
+  bool delta_locked_;
+  bool shown_;
+  Piece shown_piece_;
+  int shown_x_;
+  int shown_y_;
+
+  // Undo history.  Each remembered state keeps its scalars and column
+  // heights and the point in the row log where it started; rows are
+  // appended to the log (fill in undo_rows_, bits in undo_bits_,
+  // colours in undo_colours_) the first time they change after a push,
+  // which row_saved_ tracks by stamping each row with the serial of
+  // the state it was saved for.
+  struct UndoFrame
+  {
+    State state;
+    size_t rows;
+    unsigned serial;
+  };
+  struct UndoRow
+  {
+    int row;
+    int fill;
+  };
+  std::vector<UndoFrame> undo_;
+  std::vector<UndoRow> undo_rows_;
+  std::vector<RowBits> undo_bits_;
+  std::vector<signed char> undo_colours_;
+  std::vector<int> undo_heights_;
+  std::vector<unsigned> row_saved_;
+  unsigned undo_serial_;
+};
+
+// The complete state of a game, see Game::save().
+class GameSnapshot
+{
+public:
+  GameSnapshot()
+    : width_(0)
+    , height_(0)
+  {}
+
+  // The snapshot as raw bytes, and back.  The bytes are the engine's
+  // own memory layout, so they can only be read back by the same build
+  // of the program; fromBytes() returns false if they do not fit.
+  size_t getByteSize() const;
+  void toBytes(unsigned char* out) const;
+  bool fromBytes(const unsigned char* in, size_t size);
+
+  // The size of the game saved.  Game::restore() needs a game of the
+  // same size.
+  int getWidth() const
+  {
+    return width_;
+  }
+  int getHeight() const
+  {
+    return height_;
+  }
+
+private:
+  friend class Game;
+
+  int width_;
+  int height_;
+  std::vector<char> store_;
+  Game::State state_;
 };
 
 #endif // GAME_H
@@ -0,0 +1,346 @@
+#include "gamethread.h"
+#include "trace.h"
+#include <algorithm>
+#include <iostream>
+#include <thread>
+
+using namespace std;
+
+typedef chrono::microseconds Micros;
+
+// Gravity at the start of a game, and the fastest it can be set to
+static const Micros START_INTERVAL(300000);
+static const Micros MIN_INTERVAL(100);
+// Auto-increase stops here
+static const Micros AUTO_MIN_INTERVAL(50000);
+// Turbo plays this fast, whatever the speed setting
+static const Micros TURBO_INTERVAL(50);
+
+// More time than this owed to ticks after a stall is dropped rather
+// than played all at once.
+static const Micros MAX_LAG(250000);
+// Ticks played before looking at the queue again
+static const int MAX_BATCH = 1000;
+
+// Frames are published no faster than any display shows them
+static const Micros PUBLISH_INTERVAL(1000000 / 240);
+static const chrono::seconds LOG_PERIOD(5);
+
+GameThread::GameThread(int width, int height, unsigned long long seed,
+                       QObject *parent)
+    : QThread(parent)
+    , m_width(width)
+    , m_height(height)
+    , m_game(width, height, seed)
+    , m_changed(true)
+    , m_ticks(0)
+    , m_published(0)
+    , m_interval(START_INTERVAL)
+    , m_speedAuto(false)
+    , m_paused(false)
+    , m_turbo(false)
+    , m_lag(0)
+    , m_autoPlaying(false)
+    , m_autoPlayedPiece(0)
+    , m_quit(false)
+    , m_wake(false)
+{
+    // Start from the whole board; after this only deltas are applied
+    m_cells.resize(width*height);
+    for (int r=0; r<height; r++)
+    {
+        for (int c=0; c<width; c++)
+        {
+            m_cells[r*width + c] = m_game.get(r, c);
+        }
+    }
+    m_game.takeDelta(m_delta);
+
+    // The replay keeps the seed so the game can be played back
+    m_start = Clock::now();
+    m_replay.begin(m_game, seed);
+}
+
+GameThread::~GameThread()
+{
+    stop();
+    wait();
+}
+
+void GameThread::stop()
+{
+    m_quit.store(true, memory_order_release);
+}
+
+bool GameThread::post(CommandType type, int arg)
+{
+    Command cmd;
+    cmd.type = type;
+    cmd.arg = arg;
+    return m_commands.push(cmd);
+}
+
+void GameThread::wakeOnPublish()
+{
+    m_wake.store(true, memory_order_release);
+}
+
+const BoardFrame *GameThread::takeFrame()
+{
+    if (!m_frames.update())
+    {
+        return 0;
+    }
+    return &m_frames.front();
+}
+
+unsigned long long GameThread::elapsedMs() const
+{
+    return chrono::duration_cast<chrono::milliseconds>(
+        Clock::now() - m_start).count();
+}
+
+void GameThread::run()
+{
+    traceThreadName("game");
+    m_lastUpdate = Clock::now();
+    m_timing = TickTiming();
+    m_timing.since = m_lastUpdate;
+    publish();
+
+    while (!m_quit.load(memory_order_acquire))
+    {
+        Command cmd;
+        while (m_commands.pop(cmd))
+        {
+            execute(cmd);
+        }
+
+        Clock::time_point now = Clock::now();
+        update(now);
+
+        if (m_changed && now - m_lastPublish >= PUBLISH_INTERVAL)
+        {
+            publish();
+        }
+        if (now - m_timing.since >= LOG_PERIOD)
+        {
+            logTiming(now);
+        }
+
+        // Sleep until the next tick is due, but look at the queue at
+        // least once a millisecond so moves are not held back.
+        Clock::time_point wake = now + chrono::milliseconds(1);
+        if (!m_paused)
+        {
+            wake = min(wake, now + (tickInterval() - m_lag));
+        }
+        this_thread::sleep_until(wake);
+    }
+}
+
+GameThread::Duration GameThread::tickInterval() const
+{
+    return m_turbo ? Duration(TURBO_INTERVAL) : m_interval;
+}
+
+void GameThread::update(Clock::time_point now)
+{
+    Duration elapsed = now - m_lastUpdate;
+    m_lastUpdate = now;
+    if (m_paused)
+    {
+        return;
+    }
+
+    m_lag += elapsed;
+    if (m_lag > MAX_LAG + tickInterval())
+    {
+        // A stall (suspend, debugger, ...): give up what it owed
+        // rather than playing it all at once.
+        m_timing.dropped += m_lag / tickInterval() - 1;
+        m_lag = tickInterval();
+    }
+
+    for (int n=0; n<MAX_BATCH; n++)
+    {
+        Duration interval = tickInterval();
+        if (m_lag < interval)
+        {
+            break;
+        }
+        m_lag -= interval;
+
+        Duration late = m_lag;
+        m_timing.ticks++;
+        m_timing.lateSum += late;
+        m_timing.lateMax = max(m_timing.lateMax, late);
+
+        tick();
+    }
+}
+
+void GameThread::logTiming(Clock::time_point now)
+{
+    if (m_timing.ticks > 0)
+    {
+        double seconds = chrono::duration<double>(now - m_timing.since).count();
+        double mean = chrono::duration<double, micro>(m_timing.lateSum).count()
+                      / m_timing.ticks;
+        double worst = chrono::duration<double, micro>(m_timing.lateMax).count();
+        cout << "Ticks: " << m_timing.ticks / seconds << "/s, late by "
+             << mean << " us on average, " << worst << " us at worst";
+        if (m_timing.dropped)
+        {
+            cout << ", " << m_timing.dropped << " dropped";
+        }
+        cout << endl;
+    }
+    m_timing = TickTiming();
+    m_timing.since = now;
+}
+
+void GameThread::execute(const Command &cmd)
+{
+    TRACE_SCOPE("GameThread::execute");
+    switch (cmd.type)
+    {
+    case COMMAND_MOVE:
+    {
+        Game::Move move = (Game::Move) cmd.arg;
+        m_game.apply(move);
+        m_replay.move(move, elapsedMs());
+        m_changed = true;
+        break;
+    }
+    case COMMAND_NEW_GAME:
+        m_interval = START_INTERVAL;
+        m_game.reset();
+        m_replay.reset(elapsedMs());
+        m_autoPlayedPiece = 0;
+        m_changed = true;
+        break;
+    case COMMAND_PAUSE:
+        // Time spent paused is not owed to anything
+        m_paused = !m_paused;
+        m_lag = Duration(0);
+        break;
+    case COMMAND_SPEED_UP:
+        // 5 ms steps down to 10 ms, then a fifth at a time
+        if (m_interval > Micros(10000))
+        {
+            m_interval -= Micros(5000);
+        }
+        else
+        {
+            m_interval = max(m_interval * 4 / 5, Duration(MIN_INTERVAL));
+        }
+        break;
+    case COMMAND_SPEED_DOWN:
+        if (m_interval >= Micros(10000))
+        {
+            m_interval += Micros(5000);
+        }
+        else
+        {
+            m_interval = min(m_interval * 5 / 4, Duration(Micros(10000)));
+        }
+        break;
+    case COMMAND_SPEED_AUTO:
+        m_speedAuto = !m_speedAuto;
+        break;
+    case COMMAND_TURBO:
+        m_turbo = !m_turbo;
+        m_lag = Duration(0);
+        break;
+    case COMMAND_AUTOPLAY:
+        m_autoPlaying = !m_autoPlaying;
+        // Take over the piece that is already falling
+        if (m_autoPlaying)
+        {
+            autoPlay();
+        }
+        break;
+    case COMMAND_SAVE_REPLAY:
+    {
+        // Close a copy, so recording carries on in this one
+        ReplayWriter finished(m_replay);
+        finished.end(m_game, elapsedMs());
+        const vector<unsigned char> &data = finished.getData();
+        emit replayReady(QByteArray((const char *) data.data(),
+                                    (int) data.size()));
+        break;
+    }
+    }
+}
+
+void GameThread::tick()
+{
+    TRACE_SCOPE("GameThread::tick");
+    if (m_speedAuto && m_interval > AUTO_MIN_INTERVAL)
+    {
+        m_interval = max(m_interval - Micros(1000), Duration(AUTO_MIN_INTERVAL));
+    }
+
+    // Ticks after the game has ended change nothing, so leave them out
+    if (!m_game.isOver())
+    {
+        m_game.tick();
+        m_replay.tick(m_game, elapsedMs());
+        m_ticks++;
+        m_changed = true;
+    }
+
+    if (m_autoPlaying && m_game.getPieceCount() != m_autoPlayedPiece)
+    {
+        autoPlay();
+    }
+}
+
+void GameThread::autoPlay()
+{
+    m_autoPlayer.play(m_game);
+    const vector<Game::Move> &path = m_autoPlayer.getLastPath();
+    for (size_t i=0; i<path.size(); i++)
+    {
+        m_replay.move(path[i], elapsedMs());
+    }
+    m_autoPlayedPiece = m_game.getPieceCount();
+    m_changed = true;
+}
+
+void GameThread::publish()
+{
+    TRACE_SCOPE("GameThread::publish");
+    // Bring the thread's own copy of the board up to date from the
+    // delta, then copy it whole into the frame: the frame in the back
+    // buffer is up to three publishes old, so a delta cannot be applied
+    // to it directly.
+    m_game.takeDelta(m_delta);
+    for (size_t i=0; i<m_delta.cells.size(); i++)
+    {
+        const GameDelta::Cell &cell = m_delta.cells[i];
+        if (cell.row < m_height && cell.col < m_width)
+        {
+            m_cells[cell.row*m_width + cell.col] = cell.value;
+        }
+    }
+
+    BoardFrame &frame = m_frames.back();
+    frame.width = m_width;
+    frame.height = m_height;
+    frame.cells = m_cells;
+    frame.serial = m_published++;
+    frame.ticks = m_ticks;
+    frame.pieces = m_game.getPieceCount();
+    frame.over = m_game.isOver();
+    m_frames.publish();
+
+    m_lastPublish = Clock::now();
+    m_changed = false;
+
+    if (m_wake.exchange(false, memory_order_acq_rel))
+    {
+        emit framePublished();
+    }
+}
@@ -0,0 +1,176 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * GameThread - Runs the game on a thread of its own, so that ticks
+ * keep their rhythm however long the window takes to draw.  The window
+ * posts commands (moves, pause, speed, ...) into a lock-free queue and
+ * picks up finished frames of the board from a triple buffer; neither
+ * side ever waits for the other.
+ */
+
+#ifndef GAMETHREAD_H
+#define GAMETHREAD_H
+
+#include <QThread>
+#include <QByteArray>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include "game.h"
+#include "autoplayer.h"
+#include "replay.h"
+#include "spscqueue.h"
+#include "triplebuffer.h"
+
+// The board as the window sees it: Game::get() for every cell of the
+// rows shown, bottom row first.  Frames are complete, so the reader
+// may skip any number of them.
+struct BoardFrame
+{
+    int width;
+    int height;
+    std::vector<signed char> cells;
+
+    long serial;    // frames published before this one
+    long ticks;     // ticks played when the frame was made
+    long pieces;
+    bool over;
+
+    int get(int r, int c) const
+    {
+        return cells[r*width + c];
+    }
+};
+
+class GameThread : public QThread
+{
+    // informs the qmake that a Qt moc_* file will need to be generated
+    Q_OBJECT
+
+public:
+    enum CommandType
+    {
+        COMMAND_MOVE,           // arg is a Game::Move
+        COMMAND_NEW_GAME,
+        COMMAND_PAUSE,          // toggles
+        COMMAND_SPEED_UP,
+        COMMAND_SPEED_DOWN,
+        COMMAND_SPEED_AUTO,     // toggles
+        COMMAND_TURBO,          // toggles
+        COMMAND_AUTOPLAY,       // toggles
+        COMMAND_SAVE_REPLAY     // answered with replayReady()
+    };
+
+    struct Command
+    {
+        CommandType type;
+        int arg;
+    };
+
+    // A game of the given size, dealt from seed.  Call start() to set
+    // it going.
+    GameThread(int width, int height, unsigned long long seed,
+               QObject *parent = 0);
+
+    // Stops the thread and waits for it.
+    ~GameThread();
+
+    // Window side.  Queue a command for the game; returns false, and
+    // drops the command, if the game has fallen that far behind.
+    bool post(CommandType type, int arg = 0);
+
+    // Window side.  The latest frame, or null if there has been none
+    // since the last call.  The frame stays valid until the next call.
+    const BoardFrame *takeFrame();
+
+    // Window side.  Have the next frame published announce itself with
+    // framePublished(), once; for a window that has stopped drawing
+    // because nothing was changing.
+    void wakeOnPublish();
+
+    // Ask the thread to finish; wait() for it.
+    void stop();
+
+    int getWidth() const { return m_width; }
+    int getHeight() const { return m_height; }
+
+signals:
+    // A finished copy of the replay so far, for COMMAND_SAVE_REPLAY.
+    void replayReady(QByteArray data);
+
+    // A frame was published after wakeOnPublish().
+    void framePublished();
+
+protected:
+    void run();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::chrono::nanoseconds Duration;
+
+    // How late ticks ran: each tick is due once a whole interval has
+    // built up in m_lag, and is late by whatever was left over when it
+    // ran.  Logged and reset every few seconds.
+    struct TickTiming
+    {
+        long ticks;
+        long dropped;       // ticks given up after a stall
+        Duration lateSum;
+        Duration lateMax;
+        Clock::time_point since;
+    };
+
+    void execute(const Command &cmd);
+    void update(Clock::time_point now);
+    void tick();
+    void publish();
+    void logTiming(Clock::time_point now);
+
+    Duration tickInterval() const;
+
+    // Let the autoplayer place a new piece, and record what it did.
+    void autoPlay();
+
+    unsigned long long elapsedMs() const;
+
+    int m_width;
+    int m_height;
+
+    // Only touched by the game thread once it has started.
+    Game m_game;
+    GameDelta m_delta;
+    std::vector<signed char> m_cells;   // the board as of m_delta
+    bool m_changed;
+    long m_ticks;
+    long m_published;
+
+    // Gravity runs off a fixed-step accumulator: elapsed time is added
+    // to m_lag and one tick is played for every whole interval in it,
+    // so the rate stays exact however the thread's wakeups fall.
+    Duration m_interval;                // per tick, at normal speed
+    bool m_speedAuto;
+    bool m_paused;
+    bool m_turbo;
+    Duration m_lag;
+    Clock::time_point m_lastUpdate;
+    Clock::time_point m_lastPublish;
+    TickTiming m_timing;
+
+    AutoPlayer m_autoPlayer;
+    bool m_autoPlaying;
+    long m_autoPlayedPiece;
+
+    // Everything done to the game since it was created.  Times are
+    // from m_start.
+    ReplayWriter m_replay;
+    Clock::time_point m_start;
+
+    // Shared with the window
+    SpscQueue<Command, 256> m_commands;
+    TripleBuffer<BoardFrame> m_frames;
+    std::atomic<bool> m_quit;
+    std::atomic<bool> m_wake;
+};
+
+#endif // GAMETHREAD_H
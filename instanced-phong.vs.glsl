@@ -0,0 +1,79 @@
+#version 410 core
+
+//
+// CPSC 453 - Introduction to Computer Graphics
+// Assignment 1
+//
+// Vertex shader for the blocks of the well.  Every block is an instance
+// of one unit cube, moved to its cell and coloured from a palette; the
+// lighting is that of per-fragment-phong.vs.glsl, and the fragment
+// shader is shared.
+//
+
+// Per-vertex inputs
+layout (location = 0) in vec4 position_attr;
+layout (location = 2) in vec3 normal_attr;
+
+// Per-instance inputs: the cell (column, row), and a palette index for
+// each pair of faces, or 255 if the cell is empty
+layout (location = 3) in vec2 cell_attr;
+layout (location = 4) in uvec4 colour_attr;
+
+// Matrices we'll need
+uniform highp mat4 model_matrix;
+uniform highp mat4 view_matrix;
+uniform highp mat4 proj_matrix;
+
+// Piece colours
+uniform vec3 palette[7];
+
+// Inputs from vertex shader
+out VS_OUT
+{
+    vec3 N;
+    vec3 L;
+    vec3 V;
+    vec3 C;
+} vs_out;
+
+// Position of light
+uniform vec3 light_pos = vec3(100.0, 100.0, 100.0);
+
+void main(void)
+{
+    // The cube is six faces of four corners, coloured in pairs
+    uint index = colour_attr[gl_VertexID / 8];
+
+    if (index == 255u)
+    {
+        // An empty cell: every vertex outside the clip volume, so the
+        // whole cube is clipped away
+        vs_out.N = vec3(0.0, 0.0, 1.0);
+        vs_out.L = vec3(0.0, 0.0, 1.0);
+        vs_out.V = vec3(0.0, 0.0, 1.0);
+        vs_out.C = vec3(0.0);
+        gl_Position = vec4(2.0, 2.0, 2.0, 1.0);
+        return;
+    }
+
+    // Calculate model-view matrix
+    mat4 mv_matrix = view_matrix * model_matrix;
+
+    // Calculate view-space coordinate of the vertex in its cell
+    vec4 P = mv_matrix * (position_attr + vec4(cell_attr, 0.0, 0.0));
+
+    // Calculate normal in view-space
+    vs_out.N = mat3(mv_matrix) * normal_attr;
+
+    // Calculate light vector
+    vs_out.L = light_pos - P.xyz;
+
+    // Calculate view vector
+    vs_out.V = -P.xyz;
+
+    // Look up the colour
+    vs_out.C = palette[index];
+
+    // Calculate the clip-space position of each vertex
+    gl_Position = proj_matrix * P;
+}
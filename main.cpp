@@ -6,12 +6,44 @@
  */
 
 #include "window.h"
+#include "trace.h"
 #include <QApplication>
+#include <QCommandLineParser>
+
+// Every event the GUI thread handles goes through notify(), so timing
+// it shows where the event loop's time goes.
+class Application : public QApplication
+{
+public:
+    Application(int &argc, char **argv) : QApplication(argc, argv)
+    {
+        traceThreadName("gui");
+    }
+
+    bool notify(QObject *receiver, QEvent *event)
+    {
+        TRACE_SCOPE("event");
+        return QApplication::notify(receiver, event);
+    }
+};
 
 int main(int argc, char *argv[])
 {
-    QApplication a(argc, argv);
-    Window w;
+    Application a(argc, argv);
+
+    // The well defaults to the standard 10x24
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption widthOption("width", "Columns in the well.", "N", "10");
+    QCommandLineOption heightOption("height", "Rows in the well.", "N", "24");
+    parser.addOption(widthOption);
+    parser.addOption(heightOption);
+    parser.process(a);
+
+    int width = qBound(4, parser.value(widthOption).toInt(), (int) Game::MAX_WIDTH);
+    int height = qBound(8, parser.value(heightOption).toInt(), (int) Game::MAX_HEIGHT);
+
+    Window w(width, height);
     w.show();
 
     return a.exec();
@@ -0,0 +1,396 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * Move generation - see movegen.h.
+ */
+
+#include <algorithm>
+
+#include "movegen.h"
+
+Board::Board()
+  : width(0)
+  , height(0)
+  , full(0)
+{}
+
+Board::Board(int width, int height)
+  : width(width)
+  , height(height)
+  , full(width == 64 ? ~0ULL : (1ULL << width) - 1)
+  , rows(height + 4, 0)
+{}
+
+void Board::load(const Game& game)
+{
+  if(width != game.getWidth() || height != game.getHeight()) {
+    *this = Board(game.getWidth(), game.getHeight());
+  }
+
+  for(int r = 0; r < height + 4; ++r) {
+    rows[r] = game.getRowBits(r);
+  }
+}
+
+bool Board::fits(const Piece& p, int x, int y) const
+{
+  if(x + p.getLeftMargin() < 0) {
+    return false;
+  }
+
+  if(x + 3 - p.getRightMargin() >= width) {
+    return false;
+  }
+
+  if(y + p.getBottomMargin() < 3) {
+    return false;
+  }
+
+  for(int r = 0; r < 4; ++r) {
+    RowBits bits = p.getRowBits(r);
+    if(bits && (rows[y-r] & shiftRow(bits, x))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+int Board::lock(const Piece& p, int x, int y)
+{
+  for(int r = 0; r < 4; ++r) {
+    RowBits bits = p.getRowBits(r);
+    if(bits) {
+      rows[y-r] |= shiftRow(bits, x);
+    }
+  }
+
+  if(y >= height) {
+    return -1;
+  }
+
+  int top = height + 4;
+  int dst = std::max(y - 3, 0);
+  int removed = 0;
+
+  for(int r = dst; r < top; ++r) {
+    if(r <= y && rows[r] == full) {
+      ++removed;
+    } else {
+      rows[dst++] = rows[r];
+    }
+  }
+  std::fill(rows.begin() + dst, rows.end(), 0);
+
+  return removed;
+}
+
+MoveGen::MoveGen()
+  : width_(0)
+  , rows_(0)
+  , type_(0)
+  , start_(0)
+  , stamp_(0)
+  , searches_(0)
+{}
+
+void MoveGen::prepare(const Board& board)
+{
+  if(board.width == width_ && board.height + 4 == rows_) {
+    return;
+  }
+
+  width_ = board.width;
+  rows_ = board.height + 4;
+
+  fit_.assign(NUM_ROTATIONS * rows_, 0);
+  reach_.assign(NUM_ROTATIONS * rows_, 0);
+  rest_.assign(NUM_ROTATIONS * rows_, 0);
+
+  int nodes = NUM_ROTATIONS * rows_ * width_;
+  seen_.assign(nodes, 0);
+  parent_.assign(nodes, -1);
+  move_.assign(nodes, 0);
+  queue_.assign(nodes, 0);
+  stamp_ = 0;
+}
+
+void MoveGen::computeFit(const Board& board, int type, int top)
+{
+  // Column i of a row collides when any filled cell of the piece lands
+  // on a filled cell of the well; for a piece cell in box column c that
+  // is well column i + c - left, so shifting the well row right by
+  // c - left lines all of those tests up at once.
+  for(int rot = 0; rot < NUM_ROTATIONS; ++rot) {
+    const PieceOrientation& o = PIECE_TABLE.o[type][rot];
+    int left = o.margins[0];
+    int span = 4 - left - o.margins[2];
+    // An orientation wider than the well fits nowhere
+    int positions = width_ - span + 1;
+    RowBits valid = positions >= 64 ? ~0ULL :
+                    positions <= 0 ? 0 : (1ULL << positions) - 1;
+    RowBits* fit = &fit_[rot * rows_];
+
+    for(int y = 0; y <= top; ++y) {
+      if(y + o.margins[3] < 3) {
+        fit[y] = 0;
+        continue;
+      }
+
+      RowBits hit = 0;
+      for(int r = o.margins[1]; r < 4 - o.margins[3]; ++r) {
+        RowBits row = board.rows[y - r];
+        for(int c = left; c < 4; ++c) {
+          if(o.bits[r] & (1 << c)) {
+            hit |= row >> (c - left);
+          }
+        }
+      }
+      fit[y] = valid & ~hit;
+    }
+  }
+}
+
+void MoveGen::closeRow(int y)
+{
+  // Spread what is reachable in row y sideways and through rotations
+  // until nothing changes.  Rotating keeps the box where it is, so the
+  // column index moves by the difference in left margins.
+  bool changed = true;
+
+  while(changed) {
+    changed = false;
+
+    for(int rot = 0; rot < NUM_ROTATIONS; ++rot) {
+      RowBits fit = fit_[rot * rows_ + y];
+      RowBits m = reach_[rot * rows_ + y];
+      if(!m) {
+        continue;
+      }
+
+      RowBits prev;
+      do {
+        prev = m;
+        m |= ((m << 1) | (m >> 1)) & fit;
+      } while(m != prev);
+      reach_[rot * rows_ + y] = m;
+
+      int left = PIECE_TABLE.o[type_][rot].margins[0];
+      for(int turn = 1; turn < 4; turn += 2) {
+        int q = (rot + turn) & 3;
+        int shift = PIECE_TABLE.o[type_][q].margins[0] - left;
+        RowBits moved = shift >= 0 ? m << shift : m >> -shift;
+        RowBits add = moved & fit_[q * rows_ + y] & ~reach_[q * rows_ + y];
+        if(add) {
+          reach_[q * rows_ + y] |= add;
+          changed = true;
+        }
+      }
+    }
+  }
+}
+
+int MoveGen::generate(const Board& board, const Piece& piece, int x, int y,
+                      std::vector<Placement>& out)
+{
+  prepare(board);
+  out.clear();
+  ++searches_;
+
+  type_ = piece.getType();
+  int rot0 = piece.getRotation();
+  int i0 = x + piece.getLeftMargin();
+
+  computeFit(board, type_, y);
+  if(i0 < 0 || !((fit_[rot0 * rows_ + y] >> i0) & 1)) {
+    return 0;
+  }
+
+  for(int rot = 0; rot < NUM_ROTATIONS; ++rot) {
+    std::fill(&reach_[rot * rows_], &reach_[rot * rows_] + y + 1, 0);
+  }
+  reach_[rot0 * rows_ + y] = 1ULL << i0;
+  start_ = (rot0 * rows_ + y) * width_ + i0;
+
+  // Pieces never move up, so one sweep from the starting row down
+  // finds everything: close each row, then carry whatever fits one row
+  // lower down to it.  What cannot go lower comes to rest here.
+  for(int r = y; r >= 0; --r) {
+    closeRow(r);
+    for(int rot = 0; rot < NUM_ROTATIONS; ++rot) {
+      RowBits m = reach_[rot * rows_ + r];
+      RowBits below = r > 0 ? fit_[rot * rows_ + r - 1] : 0;
+      if(r > 0) {
+        reach_[rot * rows_ + r - 1] = m & below;
+      }
+      rest_[rot * rows_ + r] = m & ~below;
+    }
+  }
+
+  // Report each distinct set of cells once: an orientation covering the
+  // same cells as a lower-numbered one (its canonical orientation)
+  // drops the positions that one already has.
+  for(int rot = 0; rot < NUM_ROTATIONS; ++rot) {
+    const PieceOrientation& o = PIECE_TABLE.o[type_][rot];
+    const PieceOrientation& c = PIECE_TABLE.o[type_][(int) o.canonical];
+
+    for(int r = y; r >= 0; --r) {
+      RowBits m = rest_[rot * rows_ + r];
+      if(o.canonical != rot) {
+        int rc = r - o.margins[1] + c.margins[1];
+        if(rc >= 0 && rc <= y) {
+          m &= ~rest_[o.canonical * rows_ + rc];
+        }
+      }
+
+      while(m) {
+        int i = __builtin_ctzll(m);
+        m &= m - 1;
+
+        Placement pl;
+        pl.piece = Piece(type_, rot);
+        pl.x = i - o.margins[0];
+        pl.y = r;
+        out.push_back(pl);
+      }
+    }
+  }
+
+  return (int) out.size();
+}
+
+int MoveGen::generate(const Game& game, std::vector<Placement>& out)
+{
+  if(boards_.empty()) {
+    boards_.resize(Game::PREVIEW_SIZE + 2);
+  }
+  Board& board = boards_.back();
+  board.load(game);
+  return generate(board, game.getPiece(), game.getPieceX(),
+                  game.getPieceY(), out);
+}
+
+void MoveGen::getPath(const Placement& p, std::vector<Game::Move>& path)
+{
+  path.clear();
+
+  if(++stamp_ == 0) {
+    std::fill(seen_.begin(), seen_.end(), 0);
+    stamp_ = 1;
+  }
+
+  // Breadth first over single positions of the piece, so the first path
+  // found is a shortest one.  A node is (orientation, y, column) with
+  // the column taken the same way as in generate().
+  static const Game::Move MOVES[] = {
+    Game::MOVE_LEFT, Game::MOVE_RIGHT, Game::MOVE_CW, Game::MOVE_CCW,
+    Game::MOVE_DOWN
+  };
+  static const int DI[] = { -1, 1, 0, 0, 0 };
+  static const int DY[] = { 0, 0, 0, 0, -1 };
+  static const int DR[] = { 0, 0, 1, 3, 0 };
+
+  int target = (p.piece.getRotation() * rows_ + p.y) * width_
+               + p.x + p.piece.getLeftMargin();
+  int head = 0, tail = 0;
+
+  seen_[start_] = stamp_;
+  parent_[start_] = -1;
+  queue_[tail++] = start_;
+
+  while(head < tail) {
+    int node = queue_[head++];
+    if(node == target) {
+      break;
+    }
+
+    int rot = node / (rows_ * width_);
+    int y = (node / width_) % rows_;
+    int i = node % width_;
+    int left = PIECE_TABLE.o[type_][rot].margins[0];
+
+    for(int m = 0; m < 5; ++m) {
+      int q = (rot + DR[m]) & 3;
+      int qy = y + DY[m];
+      int qi = i + DI[m] + PIECE_TABLE.o[type_][q].margins[0] - left;
+
+      if(qy < 0 || qi < 0 || qi >= width_ ||
+         !((fit_[q * rows_ + qy] >> qi) & 1)) {
+        continue;
+      }
+
+      int next = (q * rows_ + qy) * width_ + qi;
+      if(seen_[next] != stamp_) {
+        seen_[next] = stamp_;
+        parent_[next] = node;
+        move_[next] = MOVES[m];
+        queue_[tail++] = next;
+      }
+    }
+  }
+
+  if(seen_[target] != stamp_) {
+    return;
+  }
+  for(int node = target; parent_[node] >= 0; node = parent_[node]) {
+    path.push_back((Game::Move) move_[node]);
+  }
+  std::reverse(path.begin(), path.end());
+}
+
+long long MoveGen::perft(const Game& game, int depth)
+{
+  if(depth <= 0) {
+    return 1;
+  }
+  depth = std::min(depth, (int) Game::PREVIEW_SIZE + 1);
+
+  levels_.resize(depth);
+  boards_.resize(Game::PREVIEW_SIZE + 2);
+  for(int i = 0; i < Game::PREVIEW_SIZE; ++i) {
+    next_[i] = game.getNextPiece(i);
+  }
+
+  Board& root = boards_.back();
+  root.load(game);
+  return perftFrom(0, depth, root, game.getPiece(), game.getPieceX(),
+                   game.getPieceY());
+}
+
+long long MoveGen::perftFrom(int level, int depth, const Board& board,
+                             const Piece& piece, int x, int y)
+{
+  std::vector<Placement>& moves = levels_[level];
+  int n = generate(board, piece, x, y, moves);
+
+  if(n == 0 && level > 0) {
+    // The piece cannot even spawn: the game ends on the next tick.
+    return 1;
+  }
+  if(depth == 1) {
+    return n;
+  }
+
+  // Pieces spawn the way Game::generateNewPiece() places them.
+  Piece next(next_[level]);
+  int nx = (board.width - 3) / 2;
+  int ny = board.height + next.getSpawnOffset();
+  Board& child = boards_[level];
+  long long total = 0;
+
+  for(int i = 0; i < n; ++i) {
+    child.width = board.width;
+    child.height = board.height;
+    child.full = board.full;
+    child.rows.assign(board.rows.begin(), board.rows.end());
+
+    if(child.lock(moves[i].piece, moves[i].x, moves[i].y) < 0) {
+      ++total;
+    } else {
+      total += perftFrom(level + 1, depth - 1, child, next, nx, ny);
+    }
+  }
+
+  return total;
+}
@@ -0,0 +1,126 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * Move generation - enumerates every place the falling piece can come
+ * to rest, by searching over (orientation, x, y) states on a compact
+ * occupancy-only copy of the well, a whole row of x positions at a
+ * time.  This is the building block for bots; it never touches the
+ * Game it was asked about.
+ */
+
+#ifndef MOVEGEN_H
+#define MOVEGEN_H
+
+#include <vector>
+
+#include "game.h"
+
+// The settled cells of a well as occupancy bits only, one word per
+// row, with the same coordinates as Game (including the four spawn
+// rows above the well).  Cheap to copy and to modify.
+struct Board
+{
+  int width;
+  int height;
+  RowBits full;
+  std::vector<RowBits> rows;
+
+  Board();
+  Board(int width, int height);
+
+  // Copy the settled cells of a game, leaving out the falling piece.
+  // Boards hold one word per row, so the well can be at most 64
+  // columns wide.
+  void load(const Game& game);
+
+  // Same test Game uses to decide whether a move is legal.
+  bool fits(const Piece& p, int x, int y) const;
+
+  // Lock a piece in at (x, y) and remove completed rows.  Returns the
+  // number of rows removed, or -1 if the piece came to rest with its
+  // box above the well, which is how Game::tick() ends a game.
+  int lock(const Piece& p, int x, int y);
+};
+
+// A final resting place: the orientation and box position in which the
+// piece locks.
+struct Placement
+{
+  Piece piece;
+  int x;
+  int y;
+};
+
+class MoveGen
+{
+public:
+  MoveGen();
+
+  // Find every place the piece can come to rest starting from (x, y),
+  // moving left, right, down or rotating one step at a time exactly as
+  // Game allows.  Placements covering the same cells (the two flat I
+  // orientations, say) are reported once.
+  // Returns the number of placements written to out.
+  int generate(const Board& board, const Piece& piece, int x, int y,
+               std::vector<Placement>& out);
+
+  // The same, for the falling piece of a game.
+  int generate(const Game& game, std::vector<Placement>& out);
+
+  // A shortest sequence of moves taking the piece from where the last
+  // generate() started to one of the placements it returned, ending
+  // with the piece at rest (it still needs a tick() to lock).
+  void getPath(const Placement& p, std::vector<Game::Move>& path);
+
+  // Count the positions reached by placing the falling piece and then
+  // the next depth-1 pieces from the preview in every possible way
+  // (depth is at most Game::PREVIEW_SIZE + 1).  A placement that ends
+  // the game counts as one position and is not searched further.
+  long long perft(const Game& game, int depth);
+
+  // Number of generate() calls made so far, for benchmarking.
+  long long getSearchCount() const
+  {
+    return searches_;
+  }
+
+private:
+  void prepare(const Board& board);
+  void computeFit(const Board& board, int type, int top);
+  void closeRow(int y);
+  long long perftFrom(int level, int depth, const Board& board,
+                      const Piece& piece, int x, int y);
+
+  int width_;
+  int rows_;
+
+  // The search works on whole rows at a time.  A piece position is
+  // indexed by the column of the leftmost occupied part of its box
+  // (x + left margin), so for every orientation and row one word holds
+  // all horizontal positions: fit_ where the piece fits, reach_ where
+  // it can get to, rest_ where it can get to but not move down from.
+  // Entry (orientation, y) is at [orientation * rows_ + y].
+  std::vector<RowBits> fit_;
+  std::vector<RowBits> reach_;
+  std::vector<RowBits> rest_;
+  int type_;
+  int start_;
+
+  // Scratch for getPath(): a breadth-first search over single piece
+  // positions (orientation, y, column), stamped so it never needs
+  // clearing.
+  std::vector<unsigned> seen_;
+  std::vector<int> parent_;
+  std::vector<unsigned char> move_;
+  std::vector<int> queue_;
+  unsigned stamp_;
+  long long searches_;
+
+  // Scratch state for perft(), one entry per level.
+  std::vector<std::vector<Placement> > levels_;
+  std::vector<Board> boards_;
+  int next_[Game::PREVIEW_SIZE];
+};
+
+#endif // MOVEGEN_H
@@ -0,0 +1,165 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * Compile-time tables describing every orientation of the seven
+ * falling pieces.  The base descriptions are the same 4x4 pictures the
+ * game has always used; all rotations, row masks, margins and spawn
+ * offsets are derived from them by the compiler, so nothing here is
+ * built at run time.
+ */
+
+#ifndef PIECES_H
+#define PIECES_H
+
+enum {
+  NUM_PIECES = 7,
+  NUM_ROTATIONS = 4
+};
+
+// One orientation of a piece.  Row 0 of the 4x4 box is the top row;
+// bit c of bits[r] is set when column c of row r is filled.
+struct PieceOrientation {
+  unsigned char bits[4];
+  unsigned short mask;      // all 16 cells, bit r*4+c
+  signed char margins[4];   // empty columns/rows: left, top, right, bottom
+  signed char spawn;        // row offset from the well height at spawn
+  signed char canonical;    // lowest rotation covering the same cells
+  signed char tops[4];      // per column: highest filled row, or 4 if empty
+  signed char bottoms[4];   // per column: lowest filled row, or -1 if empty
+};
+
+struct PieceTable {
+  PieceOrientation o[NUM_PIECES][NUM_ROTATIONS];
+};
+
+constexpr const char* PIECE_DESCS[NUM_PIECES] = {
+  ".x.."
+  ".x.."
+  ".x.."
+  ".x..",
+
+  "...."
+  ".xx."
+  ".x.."
+  ".x..",
+
+  "...."
+  ".xx."
+  "..x."
+  "..x.",
+
+  "...."
+  ".x.."
+  ".xx."
+  "..x.",
+
+  "...."
+  "..x."
+  ".xx."
+  ".x..",
+
+  "...."
+  "xxx."
+  ".x.."
+  "....",
+
+  "...."
+  ".xx."
+  ".xx."
+  "...."
+};
+
+constexpr unsigned short pieceDescMask(const char *desc)
+{
+  unsigned short mask = 0;
+  for(int i = 0; i < 16; ++i) {
+    if(desc[i] == 'x') {
+      mask |= 1 << i;
+    }
+  }
+  return mask;
+}
+
+// Clockwise rotation of a 16-bit mask: new[r][c] = old[3-c][r].  This
+// matches what Piece::rotateCW() did with getColumnRev().
+constexpr unsigned short rotateMaskCW(unsigned short mask)
+{
+  unsigned short rot = 0;
+  for(int r = 0; r < 4; ++r) {
+    for(int c = 0; c < 4; ++c) {
+      if(mask & (1 << ((3-c)*4 + r))) {
+        rot |= 1 << (r*4 + c);
+      }
+    }
+  }
+  return rot;
+}
+
+constexpr PieceOrientation makeOrientation(unsigned short mask)
+{
+  PieceOrientation o{};
+  o.mask = mask;
+
+  int left = 4, top = 4, right = 4, bottom = 4;
+  for(int c = 0; c < 4; ++c) {
+    o.tops[c] = 4;
+    o.bottoms[c] = -1;
+  }
+  for(int r = 0; r < 4; ++r) {
+    o.bits[r] = (mask >> (r*4)) & 0xF;
+    for(int c = 0; c < 4; ++c) {
+      if(o.bits[r] & (1 << c)) {
+        o.tops[c] = r < o.tops[c] ? r : o.tops[c];
+        o.bottoms[c] = r;
+        left = c < left ? c : left;
+        right = 3-c < right ? 3-c : right;
+        top = r < top ? r : top;
+        bottom = 3-r < bottom ? 3-r : bottom;
+      }
+    }
+  }
+  o.margins[0] = left;
+  o.margins[1] = top;
+  o.margins[2] = right;
+  o.margins[3] = bottom;
+  o.spawn = 3 - bottom;
+  return o;
+}
+
+// The shape of an orientation with its empty top rows and left
+// columns removed.  Two orientations of a piece with equal stripped
+// masks cover exactly the same cells once their margins line up (the
+// two horizontal I's, for instance).
+constexpr unsigned short strippedMask(const PieceOrientation& o)
+{
+  unsigned short mask = 0;
+  for(int r = 0; r + o.margins[1] < 4; ++r) {
+    mask |= (o.bits[r + o.margins[1]] >> o.margins[0]) << (r*4);
+  }
+  return mask;
+}
+
+constexpr PieceTable makePieceTable()
+{
+  PieceTable t{};
+  for(int p = 0; p < NUM_PIECES; ++p) {
+    unsigned short mask = pieceDescMask(PIECE_DESCS[p]);
+    for(int r = 0; r < NUM_ROTATIONS; ++r) {
+      t.o[p][r] = makeOrientation(mask);
+      mask = rotateMaskCW(mask);
+    }
+    for(int r = 0; r < NUM_ROTATIONS; ++r) {
+      int c = 0;
+      while(strippedMask(t.o[p][c]) != strippedMask(t.o[p][r])) {
+        ++c;
+      }
+      t.o[p][r].canonical = c;
+    }
+  }
+  return t;
+}
+
+constexpr PieceTable PIECE_TABLE = makePieceTable();
+
+#endif // PIECES_H
@@ -1,125 +1,174 @@
 #include "renderer.h"
+#include "trace.h"
 #include <QTextStream>
 #include <QOpenGLBuffer>
+#include <QOpenGLContext>
+#include <algorithm>
 #include <cmath>
+#include <cstddef>
 #include <iostream>
 
 using namespace std;
 
 // constructor
-Renderer::Renderer(QWidget *parent)
+Renderer::Renderer(int width, int height, QWidget *parent)
     : QOpenGLWidget(parent)
+    , m_borderVbo(0)
+    , m_borderIbo(0)
+    , m_borderVao(0)
+    , m_borderIndexCount(0)
+    , m_borderIndexType(GL_UNSIGNED_SHORT)
+    , m_cubeVbo(0)
+    , m_cubeIbo(0)
+    , m_cellVbo(0)
+    , m_blockColourVbo(0)
+    , m_blockVao(0)
+    , m_recolourAll(false)
+    , m_cellsUpdated(0)
+    , m_cellsUpdatedTotal(0)
+    , m_framesRendered(0)
+    , m_drawCalls(0)
+    , m_bytesUploaded(0)
+    , m_drawNanos(0)
+    , persistanceX(0)
+    , persistanceZ(0)
+    , persistanceY(0)
 {
-
+    // The board is known before OpenGL is up: frames can arrive first.
+    gameHeight = height;
+    gameWidth = width;
+    gameBoard.assign(gameHeight, vector<int>(gameWidth, -1));
+    m_blockColours.assign(gameHeight*gameWidth*4, 255);
+
+    // 40 units back frames the standard 10x24 well
+    m_viewDistance = 40.0f * max(gameWidth / 10.0f, gameHeight / 24.0f);
 }
 
-// Define the box's geometry (as triangles), normals, and colour
-const float unitCube[] = {
-    // back
-    0.,0.,0.,  1.,0.,0.,  0.,1.,0.,
-    1.,0.,0.,  1.,1.,0.,  0.,1.,0.,
-
-    // bottom
-    0.,0.,0.,  1.,0.,0.,  0.,0.,1.,
-    1.,0.,0.,  1.,0.,1.,  0.,0.,1.,
-
-    // left
-    0.,0.,0.,  0.,0.,1.,  0.,1.,0.,
-    0.,0.,1.,  0.,1.,1.,  0.,1.,0.,
+// Normals are packed 2_10_10_10: three signed ten-bit components,
+// read back normalised to -1..1.
+static constexpr GLuint packNormal(int x, int y, int z)
+{
+    return ((x * 511) & 0x3FF) | (((y * 511) & 0x3FF) << 10) |
+           (((z * 511) & 0x3FF) << 20);
+}
 
-    // top
-    1.,1.,0.,  1.,1.,1.,  0.,1.,0.,
-    1.,1.,1.,  0.,1.,1.,  0.,1.,0.,
+// A vertex of the block cube: a corner of the unit cube and the normal
+// of its face, 8 bytes.
+struct CubeVertex
+{
+    GLubyte position[4];
+    GLuint normal;
+};
 
-    // right
-    1.,0.,0.,  1.,0.,1.,  1.,1.,0.,
-    1.,0.,1.,  1.,1.,1.,  1.,1.,0.,
+// A vertex of the border mesh: a corner in cells, and the normal and
+// colour of its face, 16 bytes.
+struct MeshVertex
+{
+    GLshort position[4];
+    GLuint normal;
+    GLubyte colour[4];
+};
 
-    // front
-    0.,0.,1.,  1.,0.,1.,  0.,1.,1.,
-    1.,0.,1.,  1.,1.,1.,  0.,1.,1.,
+// The unit cube as six faces of four corners, in the order the display
+// modes colour them in pairs: back and bottom, left and top, right and
+// front.
+const int faceNormals[6][3] = {
+    {0,0,-1}, {0,-1,0}, {-1,0,0}, {0,1,0}, {1,0,0}, {0,0,1}
 };
 
-const float cubeNorms[] = {
+const CubeVertex cubeVertices[24] = {
     // back
-    0,0,-1,  0,0,-1,  0,0,-1,
-    0,0,-1,  0,0,-1,  0,0,-1,
+    {{0,0,0,1}, packNormal(0,0,-1)},  {{1,0,0,1}, packNormal(0,0,-1)},
+    {{0,1,0,1}, packNormal(0,0,-1)},  {{1,1,0,1}, packNormal(0,0,-1)},
 
     // bottom
-    0,-1,0,  0,-1,0,  0,-1,0,
-    0,-1,0,  0,-1,0,  0,-1,0,
+    {{0,0,0,1}, packNormal(0,-1,0)},  {{1,0,0,1}, packNormal(0,-1,0)},
+    {{0,0,1,1}, packNormal(0,-1,0)},  {{1,0,1,1}, packNormal(0,-1,0)},
 
     // left
-    -1,0,0,  -1,0,0,  -1,0,0,
-    -1,0,0,  -1,0,0,  -1,0,0,
+    {{0,0,0,1}, packNormal(-1,0,0)},  {{0,0,1,1}, packNormal(-1,0,0)},
+    {{0,1,0,1}, packNormal(-1,0,0)},  {{0,1,1,1}, packNormal(-1,0,0)},
 
     // top
-    0,1,0,  0,1,0,  0,1,0,
-    0,1,0,  0,1,0,  0,1,0,
+    {{1,1,0,1}, packNormal(0,1,0)},   {{1,1,1,1}, packNormal(0,1,0)},
+    {{0,1,0,1}, packNormal(0,1,0)},   {{0,1,1,1}, packNormal(0,1,0)},
 
     // right
-    1,0,0,  1,0,0,  1,0,0,
-    1,0,0,  1,0,0,  1,0,0,
+    {{1,0,0,1}, packNormal(1,0,0)},   {{1,0,1,1}, packNormal(1,0,0)},
+    {{1,1,0,1}, packNormal(1,0,0)},   {{1,1,1,1}, packNormal(1,0,0)},
 
     // front
-    0,0,1,  0,0,1,  0,0,1,
-    0,0,1,  0,0,1,  0,0,1,
+    {{0,0,1,1}, packNormal(0,0,1)},   {{1,0,1,1}, packNormal(0,0,1)},
+    {{0,1,1,1}, packNormal(0,0,1)},   {{1,1,1,1}, packNormal(0,0,1)},
 };
 
-// Convenience cube - used for sizing and initial cube
-const float cubeColors[] = {
-    1,1,1,  1,1,1,  1,1,1, // back
-    1,1,1,  1,1,1,  1,1,1,
-
-    1,1,0,  1,1,0,  1,1,0, // bottom
-    1,1,0,  1,1,0,  1,1,0,
-
-    1,0,1,  1,0,1,  1,0,1, // left
-    1,0,1,  1,0,1,  1,0,1,
-
-    1,0,0,  1,0,0,  1,0,0,  // top
-    1,0,0,  1,0,0,  1,0,0,
-
-    0,1,0,  0,1,0,  0,1,0,  // right
-    0,1,0,  0,1,0,  0,1,0,
+// Two triangles a face
+const GLubyte cubeIndices[36] = {
+    0,1,2,     1,3,2,       // back
+    4,5,6,     5,7,6,       // bottom
+    8,9,10,    9,11,10,     // left
+    12,13,14,  13,15,14,    // top
+    16,17,18,  17,19,18,    // right
+    20,21,22,  21,23,22,    // front
+};
 
-    0,0,1,  0,0,1,  0,0,1,  //front
-    0,0,1,  0,0,1,  0,0,1,
+// Colours of the faces of the border's cubes
+const GLubyte faceColours[6][3] = {
+    {255,255,255},  // back
+    {255,255,0},    // bottom
+    {255,0,255},    // left
+    {255,0,0},      // top
+    {0,255,0},      // right
+    {0,0,255},      // front
 };
 
-const float moreCubeColors[][3*3*12] = {
-    // red
-    {1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0,
-     1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0,
-     1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0, 1,0,0,},
-    // yellow?
-    {1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0,
-     1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0,
-     1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0, 1,1,0,},
-    // green
-    {0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0,
-     0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0,
-     0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0, 0,1,0,},
-    // purple?
-    {0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1,
-     0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1,
-     0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1, 0,1,1,},
-    // blue
-    {0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1,
-     0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1,
-     0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1, 0,0,1,},
-    // yellow + blue
-    {1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1,
-     1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1,
-     1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1, 1,0,1,},
-    // black
-    {},
+// Block colours by piece, for the palette of the block shader
+const float blockPalette[7][3] = {
+    {1,0,0},    // red
+    {1,1,0},    // yellow
+    {0,1,0},    // green
+    {0,1,1},    // cyan
+    {0,0,1},    // blue
+    {1,0,1},    // magenta
+    {0,0,0},    // black
 };
 
 // constructor
 Renderer::~Renderer()
 {
+    // The context outlives this part of the widget, so it must not call
+    // back into it when it goes.
+    if (context())
+    {
+        disconnect(context(), &QOpenGLContext::aboutToBeDestroyed,
+                   this, &Renderer::cleanupGL);
+    }
+    cleanupGL();
+}
 
+// Called before the context goes, whether with the widget or on its own
+// (when the widget is moved to another window, say).  initializeGL()
+// builds everything again in the new context.
+void Renderer::cleanupGL()
+{
+    // The buffers can only be deleted in their own context
+    makeCurrent();
+    if (m_borderVao)
+    {
+        glDeleteVertexArrays(1, &m_borderVao);
+        glDeleteVertexArrays(1, &m_blockVao);
+    }
+    m_buffers.destroy();
+    doneCurrent();
+
+    m_borderVbo = 0;
+    m_borderIbo = 0;
+    m_borderVao = 0;
+    m_cubeVbo = 0;
+    m_cubeIbo = 0;
+    m_cellVbo = 0;
+    m_blockColourVbo = 0;
+    m_blockVao = 0;
 }
 
 // called once by Qt GUI system, to allow initialization for OpenGL requirements
@@ -127,6 +176,9 @@ void Renderer::initializeGL()
 {
     // Qt support for inline GL function calls
 	initializeOpenGLFunctions();
+    m_buffers.initialize(this);
+    connect(context(), &QOpenGLContext::aboutToBeDestroyed,
+            this, &Renderer::cleanupGL, Qt::UniqueConnection);
 
     // sets the background clour
     glClearColor(0.7f, 0.7f, 1.0f, 1.0f);
@@ -144,29 +196,28 @@ void Renderer::initializeGL()
     m_MMatrixUniform = m_program->uniformLocation("model_matrix");
     m_programID = m_program->programId();
 
+    // the blocks have a program of their own, for instancing
+    m_blockProgram = new QOpenGLShaderProgram(this);
+    m_blockProgram->addShaderFromSourceFile(QOpenGLShader::Vertex, "instanced-phong.vs.glsl");
+    m_blockProgram->addShaderFromSourceFile(QOpenGLShader::Fragment, "per-fragment-phong.fs.glsl");
+    m_blockProgram->link();
+    m_blockPMatrixUniform = m_blockProgram->uniformLocation("proj_matrix");
+    m_blockVMatrixUniform = m_blockProgram->uniformLocation("view_matrix");
+    m_blockMMatrixUniform = m_blockProgram->uniformLocation("model_matrix");
+    glUseProgram(m_blockProgram->programId());
+    glUniform3fv(m_blockProgram->uniformLocation("palette"), 7, &blockPalette[0][0]);
+
     rotationOnX = 0;
     rotationOnZ = 0;
     rotationOnY = 0;
 
-    // Setup the triangles
-    setupBorderTriangles();
-
     // for overlapping stuff
     glEnable(GL_DEPTH_TEST);
     glClear(GL_DEPTH_BUFFER_BIT);
 
-    setupUBorder();
-
-    gameHeight = 24;
-    gameWidth = 10;
-
-    for (int i=0; i<gameHeight; i++)
-    {
-        for (int j=0; j<gameWidth; j++)
-        {
-            gameBoard[i][j] = -1;
-        }
-    }
+    // Setup the well and its triangles, then the blocks
+    setupBorder();
+    setupGameBoard();
     mouse_x = 0;
     setDisplayFace();
     scale_factor = 1.0f;
@@ -179,9 +230,12 @@ void Renderer::initializeGL()
 // called by the Qt GUI system, to allow OpenGL drawing commands
 void Renderer::paintGL()
 {
+    TRACE_SCOPE("Renderer::paintGL");
     // Clear the screen buffers
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    m_framesRendered++;
+    m_drawCalls = 0;
 
     // Set the current shader program
 
@@ -192,7 +246,7 @@ void Renderer::paintGL()
     // origin, and we need to back up to see it.
 
     QMatrix4x4 view_matrix;
-    view_matrix.translate(0.0f, 0.0f, -40.0f);
+    view_matrix.translate(0.0f, 0.0f, -m_viewDistance);
 
     glUniformMatrix4fv(m_VMatrixUniform, 1, false, view_matrix.data());
 
@@ -216,24 +270,29 @@ void Renderer::paintGL()
     QMatrix4x4 model_matrix;
 
     // You'll be drawing unit cubes, so the game will have width
-    // 10 and height 24 (game = 20, stripe = 4).  Let's translate
-    // the game so that we can draw it starting at (0,0) but have
-    // it appear centered in the window.
+    // gameWidth and height gameHeight (the well and a 4 row stripe).
+    // Let's translate the game so that we can draw it starting at
+    // (0,0) but have it appear centered in the window.
     persistanceRotate();
     model_matrix.rotate(rotationOnX, 1.0, 0.0, 0.0);
     model_matrix.rotate(rotationOnZ, 0.0, 1.0, 0.0);
     model_matrix.rotate(rotationOnY, 0.0, 0.0, 1.0);
     model_matrix.scale(scale_factor);
-    model_matrix.translate(-5.0f, -12.0f, 0.0f);
+    model_matrix.translate(-gameWidth / 2.0f, -gameHeight / 2.0f, 0.0f);
     glUniformMatrix4fv(m_MMatrixUniform, 1, false, model_matrix.data());
 
     // Not implemented: actually draw the current game state.
     // Here's some test code that draws red triangles at the
     // corners of the game board.
 
-    drawBorderTriangles();
-    drawUBorder();
-    drawGameBoard();
+    updateGameBoard();
+
+    // Time what it costs to issue the draws
+    QElapsedTimer drawClock;
+    drawClock.start();
+    drawBorder();
+    drawGameBoard(model_matrix, view_matrix);
+    m_drawNanos += drawClock.nsecsElapsed();
 
     // deactivate the program
     m_program->release();
@@ -251,8 +310,10 @@ void Renderer::resizeGL(int w, int h)
     // Set up perspective projection, using current size and aspect
     // ratio of display
     QMatrix4x4 projection_matrix;
-    projection_matrix.perspective(40.0f, (GLfloat)width() / (GLfloat)height(), 0.1f, 1000.0f);
+    projection_matrix.perspective(40.0f, (GLfloat)width() / (GLfloat)height(), 0.1f, m_viewDistance + 1000.0f);
     glUniformMatrix4fv(m_PMatrixUniform, 1, false, projection_matrix.data());
+    glUseProgram(m_blockProgram->programId());
+    glUniformMatrix4fv(m_blockPMatrixUniform, 1, false, projection_matrix.data());
 
     glViewport(0, 0, width(), height());
 
@@ -266,24 +327,27 @@ void Renderer::generateBorderTriangles()
     // make sure array lists are clear to start with
     triVertices.clear();
     triColours.clear();
+    triNormals.clear();
 
-    // add vertices to rectangle list
+    // add vertices to rectangle list, at the corners of the well below
+    // the stripe
+    float w = gameWidth, h = gameHeight - 4;
     float vectList [] = {
         0.0, 0.0, 0.0,  // bottom left triangle
         1.0, 0.0, 0.0,
         0.0, 1.0, 0.0,
 
-        9.0, 0.0, 0.0,  // bottom right triangle
-        10.0, 0.0, 0.0,
-        10.0, 1.0, 0.0,
+        w-1, 0.0, 0.0,  // bottom right triangle
+        w, 0.0, 0.0,
+        w, 1.0, 0.0,
 
-        0.0, 19.0, 0.0, // top left triangle
-        1.0, 20.0, 0.0,
-        0.0, 20.0, 0.0,
+        0.0, h-1, 0.0, // top left triangle
+        1.0, h, 0.0,
+        0.0, h, 0.0,
 
-        10.0, 19.0, 0.0,    // top right triangle
-        10.0, 20.0, 0.0,
-        9.0, 20.0, 0.0 };
+        w, h-1, 0.0,    // top right triangle
+        w, h, 0.0,
+        w-1, h, 0.0 };
     triVertices.insert(triVertices.end(), vectList, vectList + 3*4*3); // 36 items in array
 
     // shader supports per-vertex colour; add colour for each vertex add colours to colour list - use current colour
@@ -298,53 +362,6 @@ void Renderer::generateBorderTriangles()
 
 }
 
-void Renderer::setupBorderTriangles()
-{
-    generateBorderTriangles();
-    long cBufferSize = triColours.size() * sizeof(float),
-        vBufferSize = triVertices.size() * sizeof(float),
-        nBufferSize = triNormals.size() * sizeof(float);
-    borderSize = vBufferSize + cBufferSize + nBufferSize;
-
-    // Initialize VBOs
-    glGenBuffers(1, &this->m_triangleVbo);
-    glBindBuffer(GL_ARRAY_BUFFER, this->m_triangleVbo);
-
-    // Allocate space
-    glBufferData(GL_ARRAY_BUFFER, borderSize, NULL, GL_STATIC_DRAW);
-
-    // Upload the data to the GPU
-    glBufferSubData(GL_ARRAY_BUFFER, 0, vBufferSize, &triVertices[0]);
-    glBufferSubData(GL_ARRAY_BUFFER, vBufferSize, cBufferSize, &triColours[0]);
-    glBufferSubData(GL_ARRAY_BUFFER, vBufferSize + cBufferSize, nBufferSize, &triNormals[0]);
-
-    bindit();
-}
-
-void Renderer::drawBorderTriangles()
-{
-    long cBufferSize = triColours.size() * sizeof(float),
-        vBufferSize = triVertices.size() * sizeof(float);
-
-    glBindBuffer(GL_ARRAY_BUFFER, this->m_triangleVbo);
-
-    // Enable the attribute arrays
-    glEnableVertexAttribArray(this->m_posAttr);
-    glEnableVertexAttribArray(this->m_colAttr);
-    glEnableVertexAttribArray(this->m_norAttr);
-
-    glVertexAttribPointer(this->m_posAttr, 3, GL_FLOAT, 0, GL_FALSE, (const GLvoid*)(0));
-    glVertexAttribPointer(this->m_colAttr, 3, GL_FLOAT, 0, GL_FALSE, (const GLvoid*)(vBufferSize));
-    glVertexAttribPointer(this->m_norAttr, 3, GL_FLOAT, 0, GL_FALSE, (const GLvoid*)(vBufferSize + cBufferSize));
-
-    // Draw the triangles
-    glDrawArrays(GL_TRIANGLES, 0, triVertices.size()/3);
-
-    glDisableVertexAttribArray(this->m_posAttr);
-    glDisableVertexAttribArray(this->m_colAttr);
-    glDisableVertexAttribArray(this->m_norAttr);
-}
-
 // override mouse press event
 void Renderer::mousePressEvent(QMouseEvent * event)
 {
@@ -390,11 +407,16 @@ void Renderer::mouseReleaseEvent(QMouseEvent * event)
         }
         mouse_right = false;
     }
+    // start drawing any spin the drag left behind
+    update();
 }
 
 // override mouse move event
 void Renderer::mouseMoveEvent(QMouseEvent * event)
 {
+    // Nothing else redraws an idle view
+    update();
+
     if (mouse_x == 0)
     {
         mouse_x = event->x();
@@ -437,241 +459,321 @@ void Renderer::setShiftStatus(bool status)
     shift_pressed = status;
 }
 
-// Setup the U well
-void Renderer::setupUBorder()
+// Whether a cube of the U well sits at column x, row y.  The walls
+// rise from the floor to two rows short of the top.
+bool Renderer::isBorderCell(int x, int y) const
 {
-    long cBufferSize = sizeof(cubeColors) * sizeof(float),
-        vBufferSize = sizeof(unitCube) * sizeof(float),
-        nBufferSize = sizeof(cubeNorms) * sizeof(float);
-
-    float translatedCube[108];
-    for (int k=0; k<22; k++)
+    int wallTop = gameHeight - 4;
+    if (x == -1 || x == gameWidth)
     {
-        glGenBuffers(1, &this->m_borderUVaos[k]);
-        glBindBuffer(GL_ARRAY_BUFFER, this->m_borderUVaos[k]);
-
-            // Allocate buffer
-            glBufferData(GL_ARRAY_BUFFER, vBufferSize + cBufferSize + nBufferSize, NULL, GL_STATIC_DRAW);
-
-            // translation matrix
-            glm::mat4 trans = glm::translate(glm::mat4(), glm::vec3(-1.0f, (float) k-1, 0.0f));
-
-            for (int i=0; i<108; i+=3)
-            {
-                glm::vec4 result = trans * glm::vec4(unitCube[i], unitCube[i+1], unitCube[i+2], 1.0f);
-                translatedCube[i] = result.x;
-                translatedCube[i+1] = result.y;
-                translatedCube[i+2] = result.z;
-            }
-
-            // Upload the data to the GPU
-            glBufferSubData(GL_ARRAY_BUFFER, 0, vBufferSize, &translatedCube[0]);
-            glBufferSubData(GL_ARRAY_BUFFER, vBufferSize, cBufferSize, &cubeColors[0]);
-            glBufferSubData(GL_ARRAY_BUFFER, vBufferSize + cBufferSize, nBufferSize, &cubeNorms[0]);
-
-            bindit();
+        return y >= -1 && y <= wallTop;
     }
-    for (int k=0; k<10; k++)
-    {
-        glGenBuffers(1, &this->m_borderUVaos[k+22]);
-        glBindBuffer(GL_ARRAY_BUFFER, this->m_borderUVaos[k+22]);
-
-        // Allocate buffer
-        glBufferData(GL_ARRAY_BUFFER, vBufferSize + cBufferSize + nBufferSize, NULL, GL_STATIC_DRAW);
+    return y == -1 && x >= 0 && x < gameWidth;
+}
 
-        // translation matrix
-        glm::mat4 trans = glm::translate(glm::mat4(), glm::vec3((float) k, -1.0f, 0.0f));
+// Bake the U well and the corner triangles into one static, indexed
+// mesh.  Every face of a border cube that is up against another border
+// cube can never be seen, so only the outside faces go in.
+void Renderer::setupBorder()
+{
+    vector<MeshVertex> vertices;
+    vector<GLuint> indices;
 
-        for (int i=0; i<108; i+=3)
+    // The triangles, as they are
+    generateBorderTriangles();
+    for (size_t v=0; v<triVertices.size()/3; v++)
+    {
+        MeshVertex mv;
+        for (int i=0; i<3; i++)
         {
-            glm::vec4 result = trans * glm::vec4(unitCube[i], unitCube[i+1], unitCube[i+2], 1.0f);
-            translatedCube[i] = result.x;
-            translatedCube[i+1] = result.y;
-            translatedCube[i+2] = result.z;
+            mv.position[i] = (GLshort) triVertices[v*3+i];
+            mv.colour[i] = (GLubyte) (triColours[v*3+i] * 255);
         }
-
-        // Upload the data to the GPU
-        glBufferSubData(GL_ARRAY_BUFFER, 0, vBufferSize, &translatedCube[0]);
-        glBufferSubData(GL_ARRAY_BUFFER, vBufferSize, cBufferSize, &cubeColors[0]);
-        glBufferSubData(GL_ARRAY_BUFFER, vBufferSize + cBufferSize, nBufferSize, &cubeNorms[0]);
-
-        bindit();
+        mv.position[3] = 1;
+        mv.colour[3] = 255;
+        mv.normal = packNormal((int) triNormals[v*3], (int) triNormals[v*3+1],
+                               (int) triNormals[v*3+2]);
+        indices.push_back(vertices.size());
+        vertices.push_back(mv);
     }
-    for (int k=0; k<22; k++)
-    {
-        glGenBuffers(1, &this->m_borderUVaos[k+32]);
-        glBindBuffer(GL_ARRAY_BUFFER, this->m_borderUVaos[k+32]);
-
-            // Allocate buffer
-            glBufferData(GL_ARRAY_BUFFER, vBufferSize + cBufferSize + nBufferSize, NULL, GL_STATIC_DRAW);
 
-            // translation matrix
-            glm::mat4 trans = glm::translate(glm::mat4(), glm::vec3(10.0f, (float) k-1, 0.0f));
-
-            for (int i=0; i<108; i+=3)
+    int cubes = 0, faces = 0;
+    for (int y=-1; y<gameHeight; y++)
+    {
+        for (int x=-1; x<=gameWidth; x++)
+        {
+            if (!isBorderCell(x, y))
             {
-                glm::vec4 result = trans * glm::vec4(unitCube[i], unitCube[i+1], unitCube[i+2], 1.0f);
-                translatedCube[i] = result.x;
-                translatedCube[i+1] = result.y;
-                translatedCube[i+2] = result.z;
+                continue;
             }
+            cubes++;
 
-            // Upload the data to the GPU
-            glBufferSubData(GL_ARRAY_BUFFER, 0, vBufferSize, &translatedCube[0]);
-            glBufferSubData(GL_ARRAY_BUFFER, vBufferSize, cBufferSize, &cubeColors[0]);
-            glBufferSubData(GL_ARRAY_BUFFER, vBufferSize + cBufferSize, nBufferSize, &cubeNorms[0]);
-
-            bindit();
+            // four corners and two triangles a face
+            for (int f=0; f<6; f++)
+            {
+                const int *n = faceNormals[f];
+                if (n[2] == 0 && isBorderCell(x + n[0], y + n[1]))
+                {
+                    continue;
+                }
+                faces++;
+                GLuint base = vertices.size();
+                for (int i=0; i<4; i++)
+                {
+                    const CubeVertex &cv = cubeVertices[f*4 + i];
+                    MeshVertex mv;
+                    mv.position[0] = cv.position[0] + x;
+                    mv.position[1] = cv.position[1] + y;
+                    mv.position[2] = cv.position[2];
+                    mv.position[3] = 1;
+                    mv.normal = cv.normal;
+                    for (int k=0; k<3; k++)
+                    {
+                        mv.colour[k] = faceColours[f][k];
+                    }
+                    mv.colour[3] = 255;
+                    vertices.push_back(mv);
+                }
+                for (int i=0; i<6; i++)
+                {
+                    indices.push_back(base + cubeIndices[f*6 + i] - f*4);
+                }
+            }
+        }
+    }
+    m_borderIndexCount = indices.size();
+
+    // Short indices when they reach every vertex, as they do for any
+    // ordinary well; a very large one needs full ones.
+    vector<GLushort> shortIndices;
+    const void *indexData = &indices[0];
+    long indexSize = sizeof(GLuint);
+    m_borderIndexType = GL_UNSIGNED_INT;
+    if (vertices.size() <= 65536)
+    {
+        shortIndices.assign(indices.begin(), indices.end());
+        indexData = &shortIndices[0];
+        indexSize = sizeof(GLushort);
+        m_borderIndexType = GL_UNSIGNED_SHORT;
     }
-}
 
-void Renderer::drawUBorder()
-{
-    long cBufferSize = sizeof(cubeColors) * sizeof(float),
-        vBufferSize = sizeof(unitCube) * sizeof(float),
-        nBufferSize = sizeof(cubeNorms) * sizeof(float);
-    boxSize = vBufferSize + cBufferSize + nBufferSize;
+    long vBufferSize = vertices.size() * sizeof(MeshVertex),
+        iBufferSize = indices.size() * indexSize;
+    borderSize = vBufferSize + iBufferSize;
+    cout << "Border: " << cubes << " cubes baked to " << faces << " of "
+         << cubes * 6 << " faces, " << vertices.size() << " vertices, "
+         << indices.size() << " indices, " << borderSize << " bytes" << endl;
 
-    for (int k=0; k<54; k++)
-    {
-        // Bind to the correct context
-        glBindBuffer(GL_ARRAY_BUFFER, this->m_borderUVaos[k]);
+    // Upload the data to the GPU
+    m_buffers.release(this->m_borderVbo);
+    this->m_borderVbo = m_buffers.acquire(vBufferSize, GL_STATIC_DRAW, &vertices[0]);
+    m_buffers.release(this->m_borderIbo);
+    this->m_borderIbo = m_buffers.acquire(iBufferSize, GL_STATIC_DRAW, indexData);
 
-        // Enable the attribute arrays
-        glEnableVertexAttribArray(this->m_posAttr);
-        glEnableVertexAttribArray(this->m_colAttr);
-        glEnableVertexAttribArray(this->m_norAttr);
+    glDeleteVertexArrays(1, &this->m_borderVao);
+    this->m_borderVao = bindit(this->m_borderVbo, this->m_borderIbo);
+}
 
-        // Specifiy where these are in the VBO
-        glVertexAttribPointer(this->m_posAttr, 3, GL_FLOAT, 0, GL_FALSE, (const GLvoid*)(0));
-        glVertexAttribPointer(this->m_colAttr, 3, GL_FLOAT, 0, GL_FALSE, (const GLvoid*)(vBufferSize));
-        glVertexAttribPointer(this->m_norAttr, 3, GL_FLOAT, 0, GL_FALSE, (const GLvoid*)(vBufferSize + cBufferSize));
+void Renderer::drawBorder()
+{
+    glBindVertexArray(this->m_borderVao);
 
-        // Draw the triangles
-        glDrawArrays(GL_TRIANGLES, 0, 36); // 36 vertices
+    // Draw the triangles
+    glDrawElements(GL_TRIANGLES, m_borderIndexCount, m_borderIndexType, (const GLvoid*)(0));
+    m_drawCalls++;
 
-        glDisableVertexAttribArray(this->m_posAttr);
-        glDisableVertexAttribArray(this->m_colAttr);
-        glDisableVertexAttribArray(this->m_norAttr);
-    }
+    glBindVertexArray(0);
 }
 
-void Renderer::setupGameBoard(int gameBoard[][10])
+// Set up the buffers the blocks are drawn from: the cube, every cell's
+// position (which never changes) and every cell's colours, all empty to
+// begin with.
+void Renderer::setupGameBoard()
 {
-    long cBufferSize = sizeof(cubeColors) * sizeof(float),
-        vBufferSize = sizeof(unitCube) * sizeof(float),
-        nBufferSize = sizeof(cubeNorms) * sizeof(float);
+    TRACE_SCOPE("Renderer::setupGameBoard");
 
-    float translatedCube[108];
+    m_buffers.release(this->m_cubeVbo);
+    this->m_cubeVbo = m_buffers.acquire(sizeof(cubeVertices), GL_STATIC_DRAW, cubeVertices);
+    m_buffers.release(this->m_cubeIbo);
+    this->m_cubeIbo = m_buffers.acquire(sizeof(cubeIndices), GL_STATIC_DRAW, cubeIndices);
 
+    vector<GLshort> cells;
     for (int r=0; r<gameHeight; r++)
     {
         for (int c=0; c<gameWidth; c++)
         {
-            if (gameBoard[r][c] != -1)
-            {
-                glGenBuffers(1, &this->m_gameBlocksVaos[r][c]);
-                glBindBuffer(GL_ARRAY_BUFFER, this->m_gameBlocksVaos[r][c]);
-
-                // Allocate buffer
-                glBufferData(GL_ARRAY_BUFFER, vBufferSize + cBufferSize + nBufferSize, NULL, GL_STATIC_DRAW);
+            cells.push_back(c);
+            cells.push_back(r);
+        }
+    }
+    m_buffers.release(this->m_cellVbo);
+    this->m_cellVbo = m_buffers.acquire(cells.size() * sizeof(GLshort), GL_STATIC_DRAW, &cells[0]);
+
+    m_buffers.release(this->m_blockColourVbo);
+    this->m_blockColourVbo = m_buffers.acquire(m_blockColours.size(), GL_DYNAMIC_DRAW, &m_blockColours[0]);
+
+    // The cube per vertex, the cells per instance
+    glDeleteVertexArrays(1, &this->m_blockVao);
+    glGenVertexArrays(1, &this->m_blockVao);
+    glBindVertexArray(this->m_blockVao);
+
+    glBindBuffer(GL_ARRAY_BUFFER, this->m_cubeVbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, this->m_cubeIbo);
+    glEnableVertexAttribArray(0);
+    glEnableVertexAttribArray(2);
+    glVertexAttribPointer(0, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(CubeVertex),
+                          (const GLvoid*)(offsetof(CubeVertex, position)));
+    glVertexAttribPointer(2, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(CubeVertex),
+                          (const GLvoid*)(offsetof(CubeVertex, normal)));
+
+    glBindBuffer(GL_ARRAY_BUFFER, this->m_cellVbo);
+    glEnableVertexAttribArray(3);
+    glVertexAttribPointer(3, 2, GL_SHORT, GL_FALSE, 0, (const GLvoid*)(0));
+    glVertexAttribDivisor(3, 1);
+
+    glBindBuffer(GL_ARRAY_BUFFER, this->m_blockColourVbo);
+    glEnableVertexAttribArray(4);
+    glVertexAttribIPointer(4, 4, GL_UNSIGNED_BYTE, 0, (const GLvoid*)(0));
+    glVertexAttribDivisor(4, 1);
+
+    glBindVertexArray(0);
+}
 
-                // translation matrix
-                glm::mat4 trans = glm::translate(glm::mat4(), glm::vec3((float) c, (float) r, 0.0f));
+void Renderer::applyFrame(const BoardFrame &frame)
+{
+    TRACE_SCOPE("Renderer::applyFrame");
+    m_cellsUpdated = 0;
+    int rows = min(gameHeight, frame.height);
+    int cols = min(gameWidth, frame.width);
+    for (int r=0; r<rows; r++)
+    {
+        for (int c=0; c<cols; c++)
+        {
+            int value = frame.get(r, c);
+            if (value != gameBoard[r][c])
+            {
+                gameBoard[r][c] = value;
+                m_dirtyBlocks.push_back(r*gameWidth + c);
+                m_cellsUpdated++;
+            }
+        }
+    }
+    m_cellsUpdatedTotal += m_cellsUpdated;
+}
 
-                for (int i=0; i<108; i+=3)
-                {
-                    glm::vec4 result = trans * glm::vec4(unitCube[i], unitCube[i+1], unitCube[i+2], 1.0f);
-                    translatedCube[i] = result.x;
-                    translatedCube[i+1] = result.y;
-                    translatedCube[i+2] = result.z;
-                }
+// Upload the colours of the cells changed since the last paint, a run
+// of neighbouring cells at a time.
+void Renderer::updateGameBoard()
+{
+    TRACE_SCOPE("Renderer::updateGameBoard");
+    if (m_recolourAll)
+    {
+        m_dirtyBlocks.clear();
+        for (int i=0; i<gameHeight*gameWidth; i++)
+        {
+            m_dirtyBlocks.push_back(i);
+        }
+        m_recolourAll = false;
+    }
+    if (m_dirtyBlocks.empty())
+    {
+        return;
+    }
 
-                // Upload the data to the GPU
-                glBufferSubData(GL_ARRAY_BUFFER, 0, vBufferSize, &translatedCube[0]);
-                if (display_mode == 0) // wireframe display
-                {}
-                else if (display_mode == 1) // face display
-                {
-                    glBufferSubData(GL_ARRAY_BUFFER, vBufferSize, cBufferSize, &moreCubeColors[gameBoard[r][c]]);
-                }
-                else if (display_mode == 2)  // multi-face display
-                {
-                    int offset = 0;
-                    for (int p=0; p<12; p++)
-                    {
-                        glBufferSubData(GL_ARRAY_BUFFER, vBufferSize + p*144, 144, &moreCubeColors[(gameBoard[r][c] + offset) % 6]);
-                        offset++;
-                    }
-                }
-                else    // randomish display
-                {
-                    glBufferSubData(GL_ARRAY_BUFFER, vBufferSize, cBufferSize, &moreCubeColors[gameBoard[r][(rand())%gameWidth]]);
-                }
-                glBufferSubData(GL_ARRAY_BUFFER, vBufferSize + cBufferSize, nBufferSize, &cubeNorms[0]);
+    sort(m_dirtyBlocks.begin(), m_dirtyBlocks.end());
+    glBindBuffer(GL_ARRAY_BUFFER, this->m_blockColourVbo);
 
-                bindit();
-            }
-            this->gameBoard[r][c] = gameBoard[r][c];
+    size_t i = 0;
+    while (i < m_dirtyBlocks.size())
+    {
+        int first = m_dirtyBlocks[i];
+        int last = first;
+        for (; i < m_dirtyBlocks.size() && m_dirtyBlocks[i] <= last + 1; i++)
+        {
+            last = m_dirtyBlocks[i];
+            setBlockColours(last / gameWidth, last % gameWidth);
         }
+        long size = (last - first + 1) * 4;
+        glBufferSubData(GL_ARRAY_BUFFER, first * 4, size, &m_blockColours[first * 4]);
+        m_bytesUploaded += size;
     }
+    m_dirtyBlocks.clear();
 }
 
-void Renderer::drawGameBoard()
+// Work out the palette index of each pair of faces of a cell for the
+// display mode.
+void Renderer::setBlockColours(int r, int c)
 {
-    long cBufferSize = sizeof(cubeColors) * sizeof(float),
-        vBufferSize = sizeof(unitCube) * sizeof(float),
-        nBufferSize = sizeof(cubeNorms) * sizeof(float);
-    boxSize = vBufferSize + cBufferSize + nBufferSize;
+    unsigned char *colours = &m_blockColours[(r*gameWidth + c) * 4];
+    int value = gameBoard[r][c];
 
-    for (int r=0; r<gameHeight; r++)
+    if (value == -1)
     {
-        for (int c=0; c<gameWidth; c++)
+        colours[0] = colours[1] = colours[2] = 255;
+    }
+    else if (display_mode == 2)  // multi-face display
+    {
+        for (int p=0; p<3; p++)
         {
-            if (this->gameBoard[r][c] != -1)
-            {
-                // Bind to the correct context
-                glBindBuffer(GL_ARRAY_BUFFER, this->m_gameBlocksVaos[r][c]);
+            colours[p] = (value + p) % 6;
+        }
+    }
+    else if (display_mode == 3)  // randomish display
+    {
+        int other = gameBoard[r][(rand())%gameWidth];
+        colours[0] = colours[1] = colours[2] = other != -1 ? other : value;
+    }
+    else    // face display, and wireframe
+    {
+        colours[0] = colours[1] = colours[2] = value;
+    }
+}
 
-                // Enable the attribute arrays
-                glEnableVertexAttribArray(this->m_posAttr);
-                glEnableVertexAttribArray(this->m_colAttr);
-                glEnableVertexAttribArray(this->m_norAttr);
+// Draw every block with one call.  Empty cells are instances too; the
+// shader clips them away.
+void Renderer::drawGameBoard(const QMatrix4x4 &model_matrix,
+                             const QMatrix4x4 &view_matrix)
+{
+    TRACE_SCOPE("Renderer::drawGameBoard");
 
-                // Specifiy where these are in the VBO
-                glVertexAttribPointer(this->m_posAttr, 3, GL_FLOAT, 0, GL_FALSE, (const GLvoid*)(0));
-                glVertexAttribPointer(this->m_colAttr, 3, GL_FLOAT, 0, GL_FALSE, (const GLvoid*)(vBufferSize));
-                glVertexAttribPointer(this->m_norAttr, 3, GL_FLOAT, 0, GL_FALSE, (const GLvoid*)(vBufferSize + cBufferSize));
+    glUseProgram(m_blockProgram->programId());
+    glUniformMatrix4fv(m_blockMMatrixUniform, 1, false, model_matrix.data());
+    glUniformMatrix4fv(m_blockVMatrixUniform, 1, false, view_matrix.data());
 
-                // Draw the triangles
-                glDrawArrays(GL_TRIANGLES, 0, 36); // 36 vertices
+    glBindVertexArray(this->m_blockVao);
+    glDrawElementsInstanced(GL_TRIANGLES, 36, GL_UNSIGNED_BYTE, (const GLvoid*)(0),
+                            gameHeight*gameWidth);
+    m_drawCalls++;
+    glBindVertexArray(0);
 
-                glDisableVertexAttribArray(this->m_posAttr);
-                glDisableVertexAttribArray(this->m_colAttr);
-                glDisableVertexAttribArray(this->m_norAttr);
-            }
-        }
-    }
+    glUseProgram(m_programID);
 }
 
-void Renderer::bindit()
+// Capture the layout of a mesh of MeshVertex, and its index buffer, in
+// a new vertex array object, so that drawing it needs only the one bind.
+GLuint Renderer::bindit(GLuint vbo, GLuint ibo)
 {
-    long cBufferSize = sizeof(cubeColors) * sizeof(float),
-        vBufferSize = sizeof(unitCube) * sizeof(float);
+    GLuint vao;
+    glGenVertexArrays(1, &vao);
+    glBindVertexArray(vao);
+    glBindBuffer(GL_ARRAY_BUFFER, vbo);
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
 
     //Enable the attribute arrays
     glEnableVertexAttribArray(this->m_posAttr);
     glEnableVertexAttribArray(this->m_colAttr);
     glEnableVertexAttribArray(this->m_norAttr);
 
-    // Specifiy where these are in the VBO
-    glVertexAttribPointer(this->m_posAttr, 3, GL_FLOAT, 0, GL_FALSE, (const GLvoid*)(0));
-    glVertexAttribPointer(this->m_colAttr, 3, GL_FLOAT, 0, GL_FALSE, (const GLvoid*)(vBufferSize));
-    glVertexAttribPointer(this->m_norAttr, 3, GL_FLOAT, 0, GL_FALSE, (const GLvoid*)(vBufferSize + cBufferSize));
+    // Specifiy where these are in each vertex
+    glVertexAttribPointer(this->m_posAttr, 4, GL_SHORT, GL_FALSE, sizeof(MeshVertex),
+                          (const GLvoid*)(offsetof(MeshVertex, position)));
+    glVertexAttribPointer(this->m_colAttr, 3, GL_UNSIGNED_BYTE, GL_TRUE, sizeof(MeshVertex),
+                          (const GLvoid*)(offsetof(MeshVertex, colour)));
+    glVertexAttribPointer(this->m_norAttr, 4, GL_INT_2_10_10_10_REV, GL_TRUE, sizeof(MeshVertex),
+                          (const GLvoid*)(offsetof(MeshVertex, normal)));
 
-    glDisableVertexAttribArray(this->m_posAttr);
-    glDisableVertexAttribArray(this->m_colAttr);
-    glDisableVertexAttribArray(this->m_norAttr);
+    glBindVertexArray(0);
+    return vao;
 }
 
 void Renderer::resetView()
@@ -683,40 +785,65 @@ void Renderer::resetView()
     persistanceX = 0;
     persistanceZ = 0;
     persistanceY = 0;
+    update();
 }
 
 void Renderer::setDisplayWireFrame()
 {
     display_mode = 0;
+    m_recolourAll = true;
+    update();
 }
 
 void Renderer::setDisplayFace()
 {
     display_mode = 1;
+    m_recolourAll = true;
+    update();
 }
 
 void Renderer::setDisplayMultiColored()
 {
     display_mode = 2;
+    m_recolourAll = true;
+    update();
 }
 
 void Renderer::setDisplayRandomColored()
 {
     display_mode = 3;
+    m_recolourAll = true;
+    update();
+}
+
+bool Renderer::isAnimating() const
+{
+    return (persistanceX != 0 && !mouse_left) ||
+           (persistanceZ != 0 && !mouse_middle) ||
+           (persistanceY != 0 && !mouse_right);
 }
 
 void Renderer::persistanceRotate()
 {
+    // A spin turns by its drag step every 33 ms, the old fixed frame
+    // time.  The first frame after a pause counts as one step.
+    float steps = 1.0f;
+    if (m_frameClock.isValid() && m_frameClock.elapsed() < 100)
+    {
+        steps = m_frameClock.elapsed() / 33.0f;
+    }
+    m_frameClock.start();
+
     if (!mouse_left)
     {
-        rotationOnX -= persistanceX;
+        rotationOnX -= persistanceX * steps;
     }
     if (!mouse_middle)
     {
-        rotationOnZ -= persistanceZ;
+        rotationOnZ -= persistanceZ * steps;
     }
     if (!mouse_right)
     {
-        rotationOnY -= persistanceY;
+        rotationOnY -= persistanceY * steps;
     }
 }
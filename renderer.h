@@ -16,8 +16,11 @@
 #include <QOpenGLShader>
 #include <QMouseEvent>
 #include <QKeySequence>
+#include <QElapsedTimer>
 #include <glm/glm.hpp>
 #include "glm/gtc/matrix_transform.hpp"
+#include "bufferpool.h"
+#include "gamethread.h"
 
 using namespace std;
 
@@ -28,16 +31,42 @@ class Renderer : public QOpenGLWidget, protected QOpenGLFunctions_4_2_Core
     Q_OBJECT
 
 public:
-    // constructor
-    Renderer(QWidget *parent = 0);
+    // constructor, for a well of the given size (the rows shown, not
+    // counting the rows above the well)
+    Renderer(int width, int height, QWidget *parent = 0);
 
-    int gameBoard[24][10];
+    vector<vector<int> > gameBoard;
 
     // destructor
     virtual ~Renderer();
 
-    // publicly available since Game instance is inside Window
-    void setupGameBoard(int gameBoard[][10]);
+    // Show a frame from the game thread.  Only the cells that differ
+    // from the last frame shown are touched; their GPU data is updated
+    // at the next paint.
+    void applyFrame(const BoardFrame &frame);
+
+    // Cells changed by the last frame, and by all frames so far.
+    int cellsUpdated() const { return m_cellsUpdated; }
+    long cellsUpdatedTotal() const { return m_cellsUpdatedTotal; }
+
+    // Whether the view is still moving by itself (spinning after a
+    // drag), so it needs drawing again even if nothing else changes.
+    bool isAnimating() const;
+
+    // Frames drawn so far.
+    long framesRendered() const { return m_framesRendered; }
+
+    // Draw calls made by the last frame, and bytes of block colours
+    // uploaded so far.
+    int drawCalls() const { return m_drawCalls; }
+    long bytesUploaded() const { return m_bytesUploaded; }
+
+    // CPU time spent issuing the draws of every frame so far, in
+    // nanoseconds.
+    long drawNanos() const { return m_drawNanos; }
+
+    // The GL buffers the renderer holds.
+    const BufferPool &buffers() const { return m_buffers; }
 
     // Stuff for bindings called by window.
     void setShiftStatus(bool status);
@@ -71,6 +100,12 @@ protected:
     // Called when the mouse moves
     virtual void mouseMoveEvent(QMouseEvent * event);
 
+private slots:
+
+    // Delete every GL object while the context is still there to
+    // delete them in.
+    void cleanupGL();
+
 private:
 
     // member variables for shader manipulation
@@ -79,20 +114,62 @@ private:
     GLuint m_VMatrixUniform; // view matrix
     GLuint m_PMatrixUniform; // projection matrix
 
-    GLuint m_triangleVbo;
     GLuint m_posAttr;
     GLuint m_colAttr;
     GLuint m_norAttr;
 
     GLuint m_boxVbo;
 
-    GLuint m_borderUVaos[54];
-
-    GLuint m_gameBlocksVaos[24][10];
+    // The well and the corner triangles, baked into one indexed mesh of
+    // m_borderIndexCount indices of type m_borderIndexType.
+    GLuint m_borderVbo;
+    GLuint m_borderIbo;
+    GLuint m_borderVao;
+    int m_borderIndexCount;
+    GLenum m_borderIndexType;
+
+    // Owns every buffer the renderer uses.
+    BufferPool m_buffers;
+
+    // The blocks of the well are all drawn at once, as instances of one
+    // unit cube.  m_cubeVbo holds the cube's 24 corners (position and
+    // packed normal, interleaved) and m_cubeIbo its 36 indices,
+    // m_cellVbo the column and row of every cell (two shorts each), and
+    // m_blockColourVbo a palette index for each pair of faces of every
+    // cell (four bytes; 255 if the cell is empty), as m_blockColours.
+    GLuint m_cubeVbo;
+    GLuint m_cubeIbo;
+    GLuint m_cellVbo;
+    GLuint m_blockColourVbo;
+    GLuint m_blockVao;
+    vector<unsigned char> m_blockColours;
+
+    QOpenGLShaderProgram *m_blockProgram;
+    GLuint m_blockMMatrixUniform;
+    GLuint m_blockVMatrixUniform;
+    GLuint m_blockPMatrixUniform;
+
+    // Cells (r*gameWidth + c) whose colours need uploading, and whether
+    // every cell does (after a display mode change).
+    vector<int> m_dirtyBlocks;
+    bool m_recolourAll;
+    int m_cellsUpdated;
+    long m_cellsUpdatedTotal;
+    long m_framesRendered;
+    int m_drawCalls;
+    long m_bytesUploaded;
+    long m_drawNanos;
+
+    // Time since the last frame, so a spin keeps its speed whatever the
+    // frame rate.
+    QElapsedTimer m_frameClock;
 
     int gameHeight;
     int gameWidth;
 
+    // How far back the camera sits to see the whole well
+    float m_viewDistance;
+
     QOpenGLShaderProgram *m_program;
 
     // for storing triangle vertices and colours
@@ -100,11 +177,6 @@ private:
     vector<GLfloat> triColours;
     vector<GLfloat> triNormals;
 
-    vector<GLfloat> vertices;
-    vector<GLfloat> colours;
-    vector<GLfloat> normals;
-
-    long boxSize;
     long borderSize;
 
     // member variables for rotations
@@ -115,9 +187,9 @@ private:
     bool mouse_middle;
     bool mouse_right;
     bool shift_pressed;
-    int rotationOnX;
-    int rotationOnZ;
-    int rotationOnY;
+    float rotationOnX;
+    float rotationOnZ;
+    float rotationOnY;
     int persistanceX;
     int persistanceZ;
     int persistanceY;
@@ -129,17 +201,21 @@ private:
     GLuint loadShader(GLenum type, const char *source);
 
     // helper function for drawing bordering triangles
-    void setupBorderTriangles();
     void generateBorderTriangles();
-    void drawBorderTriangles();
 
     //draws the actual game state
-    void drawGameBoard();
+    void setupGameBoard();
+    void updateGameBoard();
+    void setBlockColours(int r, int c);
+    void drawGameBoard(const QMatrix4x4 &model_matrix,
+                       const QMatrix4x4 &view_matrix);
     void persistanceRotate();
 
-    void setupUBorder();
-    void drawUBorder();
-    void bindit();
+    // the well, triangles included
+    bool isBorderCell(int x, int y) const;
+    void setupBorder();
+    void drawBorder();
+    GLuint bindit(GLuint vbo, GLuint ibo);
 
 
 };
@@ -0,0 +1,506 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * Replays - see replay.h.
+ */
+
+#include <cstdio>
+#include <cstring>
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define REPLAY_MMAP 1
+#endif
+
+#include "replay.h"
+
+static const unsigned char MAGIC[4] = { 'T', 'R', 'P', 'L' };
+static const int VERSION = 1;
+
+enum {
+  EVENT_TICK = 6,
+  EVENT_RESET = 7,
+  EVENT_KEYFRAME = 8,
+  EVENT_END = 9,
+  EVENT_REPEAT = 10
+};
+
+ReplayWriter::ReplayWriter(int keyframeTicks, bool withSnapshots)
+  : keyframe_ticks_(keyframeTicks)
+  , with_snapshots_(withSnapshots)
+  , ticks_(0)
+  , last_ms_(0)
+  , ended_(false)
+  , last_type_(-1)
+  , repeat_(0)
+{}
+
+void ReplayWriter::begin(const Game& game, unsigned long long seed)
+{
+  ticks_ = 0;
+  last_ms_ = 0;
+  ended_ = false;
+  last_type_ = -1;
+  repeat_ = 0;
+
+  data_.assign(MAGIC, MAGIC + 4);
+  data_.push_back(VERSION);
+  putVarint(game.getWidth());
+  putVarint(game.getHeight());
+  putU64(seed);
+  data_.push_back(game.getRandomizer());
+}
+
+void ReplayWriter::move(Game::Move move, unsigned long long ms)
+{
+  event(move, ms);
+}
+
+void ReplayWriter::tick(const Game& game, unsigned long long ms)
+{
+  event(EVENT_TICK, ms);
+  ++ticks_;
+  if(keyframe_ticks_ > 0 && ticks_ % keyframe_ticks_ == 0) {
+    event(EVENT_KEYFRAME, ms);
+    keyframe(game);
+  }
+}
+
+void ReplayWriter::reset(unsigned long long ms)
+{
+  event(EVENT_RESET, ms);
+}
+
+void ReplayWriter::end(const Game& game, unsigned long long ms)
+{
+  event(EVENT_END, ms);
+  putVarint(ticks_);
+  putU64(game.getChecksum());
+  ended_ = true;
+}
+
+bool ReplayWriter::save(const char* path) const
+{
+  FILE* f = fopen(path, "wb");
+  if(!f) {
+    return false;
+  }
+  bool ok = fwrite(data_.data(), 1, data_.size(), f) == data_.size();
+  return fclose(f) == 0 && ok;
+}
+
+void ReplayWriter::event(int type, unsigned long long ms)
+{
+  if(ended_ || data_.empty()) {
+    return;
+  }
+
+  unsigned long long delta = ms > last_ms_ ? ms - last_ms_ : 0;
+  last_ms_ = ms > last_ms_ ? ms : last_ms_;
+
+  if(type < EVENT_TICK && type == last_type_ && delta == 0) {
+    ++repeat_;
+    return;
+  }
+  flushRepeat();
+  last_type_ = type;
+
+  if(delta < 15) {
+    data_.push_back(type | (delta << 4));
+  } else {
+    data_.push_back(type | 0xF0);
+    putVarint(delta - 15);
+  }
+}
+
+void ReplayWriter::flushRepeat()
+{
+  if(repeat_ == 1) {
+    data_.push_back(last_type_);
+  } else if(repeat_ > 1) {
+    data_.push_back(EVENT_REPEAT);
+    putVarint(repeat_);
+  }
+  repeat_ = 0;
+}
+
+void ReplayWriter::keyframe(const Game& game)
+{
+  putVarint(ticks_);
+  putU64(game.getChecksum());
+
+  if(!with_snapshots_) {
+    putVarint(0);
+    return;
+  }
+
+  game.save(snapshot_);
+  bytes_.resize(snapshot_.getByteSize());
+  snapshot_.toBytes(bytes_.data());
+  putVarint(bytes_.size());
+  data_.insert(data_.end(), bytes_.begin(), bytes_.end());
+}
+
+void ReplayWriter::putVarint(unsigned long long v)
+{
+  while(v >= 0x80) {
+    data_.push_back((v & 0x7F) | 0x80);
+    v >>= 7;
+  }
+  data_.push_back(v);
+}
+
+void ReplayWriter::putU64(unsigned long long v)
+{
+  for(int i = 0; i < 8; ++i) {
+    data_.push_back(v >> (8*i));
+  }
+}
+
+ReplayPlayer::ReplayPlayer()
+  : data_(0)
+  , size_(0)
+  , pos_(0)
+  , events_(0)
+  , mapped_(false)
+  , width_(0)
+  , height_(0)
+  , seed_(0)
+  , randomizer_(Game::RANDOM_UNIFORM)
+  , error_("no replay open")
+  , last_move_(-1)
+  , ticks_(0)
+  , moves_(0)
+  , keyframes_(0)
+  , ms_(0)
+{}
+
+ReplayPlayer::~ReplayPlayer()
+{
+  close();
+}
+
+bool ReplayPlayer::open(const char* path)
+{
+  close();
+
+#ifdef REPLAY_MMAP
+  int fd = ::open(path, O_RDONLY);
+  if(fd < 0) {
+    return fail("cannot open file");
+  }
+  struct stat st;
+  if(fstat(fd, &st) < 0 || st.st_size == 0) {
+    ::close(fd);
+    return fail("cannot read file");
+  }
+  void* p = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  ::close(fd);
+  if(p == MAP_FAILED) {
+    return fail("cannot map file");
+  }
+  data_ = (const unsigned char*) p;
+  size_ = st.st_size;
+  mapped_ = true;
+  return readHeader();
+#else
+  // No mmap(): read the whole file and keep it for as long as it is
+  // open.
+  FILE* f = fopen(path, "rb");
+  if(!f) {
+    return fail("cannot open file");
+  }
+  fseek(f, 0, SEEK_END);
+  long n = ftell(f);
+  fseek(f, 0, SEEK_SET);
+  unsigned char* buf = n > 0 ? new unsigned char[n] : 0;
+  bool ok = buf && fread(buf, 1, n, f) == (size_t) n;
+  fclose(f);
+  if(!ok) {
+    delete [] buf;
+    return fail("cannot read file");
+  }
+  data_ = buf;
+  size_ = n;
+  mapped_ = true;
+  return readHeader();
+#endif
+}
+
+bool ReplayPlayer::open(const unsigned char* data, size_t size)
+{
+  close();
+  data_ = data;
+  size_ = size;
+  return readHeader();
+}
+
+void ReplayPlayer::close()
+{
+  if(mapped_) {
+#ifdef REPLAY_MMAP
+    munmap((void*) data_, size_);
+#else
+    delete [] data_;
+#endif
+  }
+  data_ = 0;
+  size_ = 0;
+  mapped_ = false;
+  error_ = "no replay open";
+}
+
+bool ReplayPlayer::fail(const char* error)
+{
+  error_ = error;
+  return false;
+}
+
+bool ReplayPlayer::readHeader()
+{
+  pos_ = 0;
+  if(size_ < 5 || memcmp(data_, MAGIC, 4) != 0) {
+    return fail("not a replay");
+  }
+  if(data_[4] != VERSION) {
+    return fail("unknown replay version");
+  }
+  pos_ = 5;
+
+  unsigned long long width, height;
+  if(!getVarint(width) || !getVarint(height) || !getU64(seed_) ||
+     pos_ >= size_) {
+    return fail("truncated header");
+  }
+  if(width == 0 || width > Game::MAX_WIDTH || height == 0 ||
+     height > Game::MAX_HEIGHT) {
+    return fail("bad well size");
+  }
+  width_ = width;
+  height_ = height;
+  randomizer_ = data_[pos_++] == Game::RANDOM_BAG ? Game::RANDOM_BAG
+                                                  : Game::RANDOM_UNIFORM;
+  events_ = pos_;
+  error_ = "";
+  return true;
+}
+
+bool ReplayPlayer::getVarint(unsigned long long& v)
+{
+  v = 0;
+  for(int shift = 0; shift < 64; shift += 7) {
+    if(pos_ >= size_) {
+      return false;
+    }
+    unsigned char b = data_[pos_++];
+    v |= (unsigned long long) (b & 0x7F) << shift;
+    if(!(b & 0x80)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+bool ReplayPlayer::getU64(unsigned long long& v)
+{
+  if(size_ - pos_ < 8) {
+    return false;
+  }
+  v = 0;
+  for(int i = 0; i < 8; ++i) {
+    v |= (unsigned long long) data_[pos_++] << (8*i);
+  }
+  return true;
+}
+
+bool ReplayPlayer::next(Event& e)
+{
+  if(pos_ >= size_) {
+    return fail("log ends without an end record");
+  }
+
+  unsigned char b = data_[pos_++];
+  unsigned long long delta = b >> 4;
+  if(delta == 15) {
+    if(!getVarint(delta)) {
+      return fail("truncated event");
+    }
+    delta += 15;
+  }
+  ms_ += delta;
+  e.type = b & 0xF;
+
+  if(e.type == EVENT_KEYFRAME || e.type == EVENT_END) {
+    unsigned long long ticks;
+    if(!getVarint(ticks) || !getU64(e.checksum)) {
+      return fail("truncated event");
+    }
+    e.ticks = ticks;
+    e.snapshot = 0;
+    e.snapshotSize = 0;
+  }
+  if(e.type == EVENT_KEYFRAME) {
+    unsigned long long size;
+    if(!getVarint(size) || size > size_ - pos_) {
+      return fail("truncated keyframe");
+    }
+    e.snapshot = data_ + pos_;
+    e.snapshotSize = size;
+    pos_ += size;
+  }
+
+  // A repeat comes back as the move it repeats, n times over.
+  e.count = 1;
+  if(e.type == EVENT_REPEAT) {
+    if(!getVarint(e.count) || last_move_ < 0) {
+      return fail("bad repeat");
+    }
+    e.type = last_move_;
+  } else if(e.type > EVENT_REPEAT) {
+    return fail("unknown event");
+  }
+  last_move_ = e.type < EVENT_TICK ? e.type : -1;
+  return true;
+}
+
+void ReplayPlayer::applyRun(Game& game, const Event& e)
+{
+  // A move that fails leaves the game as it was, so the rest of the run
+  // would fail too; and four rotations that all succeed bring the piece
+  // back to where it started.  Either way a run takes a handful of
+  // moves however long the file says it is.
+  Game::Move move = (Game::Move) e.type;
+  bool rotation = move == Game::MOVE_CW || move == Game::MOVE_CCW;
+  unsigned long long n = e.count;
+  for(unsigned long long i = 0; i < n; ++i) {
+    if(!game.apply(move)) {
+      break;
+    }
+    if(rotation && i == 3) {
+      n = 4 + (n - 4) % 4;
+    }
+  }
+  moves_ += e.count;
+}
+
+void ReplayPlayer::start(Game& game)
+{
+  game.setRandomizer(randomizer_);
+  game.reset(seed_);
+  pos_ = events_;
+  last_move_ = -1;
+  ticks_ = 0;
+  moves_ = 0;
+  keyframes_ = 0;
+  ms_ = 0;
+}
+
+bool ReplayPlayer::run(Game& game)
+{
+  if(!data_ || game.getWidth() != width_ || game.getHeight() != height_) {
+    return fail("no replay open, or the game is the wrong size");
+  }
+  start(game);
+
+  Event e;
+  while(next(e)) {
+    switch(e.type) {
+    case EVENT_TICK:
+      game.tick();
+      ++ticks_;
+      break;
+    case EVENT_RESET:
+      game.reset();
+      break;
+    case EVENT_KEYFRAME:
+      ++keyframes_;
+      if(e.ticks != ticks_ || e.checksum != game.getChecksum()) {
+        return fail("game differs from a keyframe");
+      }
+      break;
+    case EVENT_END:
+      if(e.ticks != ticks_ || e.checksum != game.getChecksum()) {
+        return fail("game differs from the final state");
+      }
+      error_ = "";
+      return true;
+    default:
+      applyRun(game, e);
+      break;
+    }
+  }
+  return false;
+}
+
+bool ReplayPlayer::seek(Game& game, long tick)
+{
+  if(!data_ || game.getWidth() != width_ || game.getHeight() != height_) {
+    return fail("no replay open, or the game is the wrong size");
+  }
+
+  // Find the last keyframe at or before the tick whose snapshot this
+  // build can read, without simulating anything.
+  start(game);
+  size_t from = events_;
+  long fromTicks = 0;
+  unsigned long long fromMs = 0;
+  const unsigned char* snapshot = 0;
+  size_t snapshotSize = 0;
+
+  Event e;
+  while(next(e) && e.type != EVENT_END) {
+    if(e.type != EVENT_KEYFRAME) {
+      continue;
+    }
+    if(e.ticks > tick) {
+      break;
+    }
+    if(e.snapshotSize > 0 &&
+       snapshot_.fromBytes(e.snapshot, e.snapshotSize) &&
+       snapshot_.getWidth() == width_ && snapshot_.getHeight() == height_) {
+      from = pos_;
+      fromTicks = e.ticks;
+      fromMs = ms_;
+      snapshot = e.snapshot;
+      snapshotSize = e.snapshotSize;
+    }
+  }
+
+  start(game);
+  if(snapshot) {
+    snapshot_.fromBytes(snapshot, snapshotSize);
+    game.restore(snapshot_);
+    pos_ = from;
+    ticks_ = fromTicks;
+    ms_ = fromMs;
+  }
+
+  while(ticks_ < tick && next(e)) {
+    switch(e.type) {
+    case EVENT_TICK:
+      game.tick();
+      ++ticks_;
+      break;
+    case EVENT_RESET:
+      game.reset();
+      break;
+    case EVENT_KEYFRAME:
+      ++keyframes_;
+      break;
+    case EVENT_END:
+      return fail("tick is past the end of the replay");
+    default:
+      applyRun(game, e);
+      break;
+    }
+  }
+  if(ticks_ < tick) {
+    return false;
+  }
+  error_ = "";
+  return true;
+}
@@ -0,0 +1,200 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * Replays - a compact binary log of everything that happened to a
+ * game (the seed it started from, then every move and tick), and a
+ * player that re-simulates a log as fast as the engine goes, checking
+ * it against the states recorded along the way.
+ *
+ * File layout (all multi-byte integers little endian; varints are
+ * LEB128, seven bits per byte, low bits first):
+ *
+ *   "TRPL"  magic
+ *   u8      version (1)
+ *   varint  width, height
+ *   u64     seed
+ *   u8      randomizer (Game::Randomizer)
+ *
+ * then events.  Each event starts with one byte: the low nibble is the
+ * event type and the high nibble the milliseconds since the previous
+ * event, or 15 if that does not fit, in which case the milliseconds
+ * minus 15 follow as a varint.
+ *
+ *   0-5  a Game::Move
+ *   6    tick
+ *   7    reset (without reseeding, like Game::reset())
+ *   8    keyframe: varint ticks so far, u64 Game::getChecksum(),
+ *        varint size and a GameSnapshot in GameSnapshot::toBytes()
+ *        form (size 0 if it was left out)
+ *   9    end: varint ticks, u64 checksum of the final state
+ *   10   repeat: varint n, the previous move made n more times (bots
+ *        soft-drop a row at a time, so runs are common)
+ *
+ * The snapshots in keyframes are only used for seeking, and only by a
+ * build that can read them; the checksums work everywhere.
+ */
+
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <cstddef>
+#include <vector>
+
+#include "game.h"
+
+class ReplayWriter
+{
+public:
+  // A keyframe is written every keyframeTicks ticks (never if 0).
+  // Snapshots are only included when withSnapshots is set.
+  explicit ReplayWriter(int keyframeTicks = 1000, bool withSnapshots = true);
+
+  // Start a new log for a game that has just been reset with seed.
+  void begin(const Game& game, unsigned long long seed);
+
+  // Record what was done to the game.  ms is a time in milliseconds
+  // from any fixed point; it must never go backwards.  tick() is called
+  // after Game::tick() with the game as it left it.
+  void move(Game::Move move, unsigned long long ms);
+  void tick(const Game& game, unsigned long long ms);
+  void reset(unsigned long long ms);
+
+  // Close the log with the final state.  Nothing more can be recorded.
+  void end(const Game& game, unsigned long long ms);
+
+  const std::vector<unsigned char>& getData() const
+  {
+    return data_;
+  }
+  long getTicks() const
+  {
+    return ticks_;
+  }
+
+  bool save(const char* path) const;
+
+private:
+  void event(int type, unsigned long long ms);
+  void flushRepeat();
+  void keyframe(const Game& game);
+  void putVarint(unsigned long long v);
+  void putU64(unsigned long long v);
+
+  std::vector<unsigned char> data_;
+  int keyframe_ticks_;
+  bool with_snapshots_;
+  long ticks_;
+  unsigned long long last_ms_;
+  bool ended_;
+
+  // A run of the same move in the same millisecond is held back and
+  // written as one repeat event.
+  int last_type_;
+  unsigned long long repeat_;
+
+  // Scratch, kept to avoid allocating at every keyframe.
+  GameSnapshot snapshot_;
+  std::vector<unsigned char> bytes_;
+};
+
+class ReplayPlayer
+{
+public:
+  ReplayPlayer();
+  ~ReplayPlayer();
+
+  // Map a replay file into memory, or play from bytes the caller keeps
+  // alive.  Both check the header.
+  bool open(const char* path);
+  bool open(const unsigned char* data, size_t size);
+  void close();
+
+  // The game the log was recorded from.  Pass run() and seek() a game
+  // of this size.
+  int getWidth() const
+  {
+    return width_;
+  }
+  int getHeight() const
+  {
+    return height_;
+  }
+  unsigned long long getSeed() const
+  {
+    return seed_;
+  }
+
+  // Replay the whole log from the seed, checking the game against
+  // every keyframe and the end record.  Returns false if the log is
+  // damaged or the game went a different way; getError() says which.
+  bool run(Game& game);
+
+  // Bring the game to where it was after the given number of ticks,
+  // restoring the last usable keyframe before it and simulating the
+  // rest.
+  bool seek(Game& game, long tick);
+
+  const char* getError() const
+  {
+    return error_;
+  }
+
+  // What the last run() or seek() went through.
+  long getTicks() const
+  {
+    return ticks_;
+  }
+  long getMoves() const
+  {
+    return moves_;
+  }
+  long getKeyframes() const
+  {
+    return keyframes_;
+  }
+  unsigned long long getMilliseconds() const
+  {
+    return ms_;
+  }
+
+private:
+  struct Event
+  {
+    int type;
+    unsigned long long count;
+    long ticks;
+    unsigned long long checksum;
+    const unsigned char* snapshot;
+    size_t snapshotSize;
+  };
+
+  bool readHeader();
+  bool next(Event& e);
+  bool getVarint(unsigned long long& v);
+  bool getU64(unsigned long long& v);
+  bool fail(const char* error);
+  void start(Game& game);
+  void applyRun(Game& game, const Event& e);
+
+  const unsigned char* data_;
+  size_t size_;
+  size_t pos_;
+  size_t events_;
+  bool mapped_;
+
+  int width_;
+  int height_;
+  unsigned long long seed_;
+  Game::Randomizer randomizer_;
+
+  const char* error_;
+  int last_move_;
+  long ticks_;
+  long moves_;
+  long keyframes_;
+  unsigned long long ms_;
+  GameSnapshot snapshot_;
+};
+
+#endif // REPLAY_H
@@ -0,0 +1,62 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * Rng - Small, fast, seedable pseudo-random generator (xoshiro256**,
+ * seeded through splitmix64).  Each Game owns one, so games never
+ * share generator state and a given seed always produces the same
+ * sequence of pieces.
+ */
+
+#ifndef RNG_H
+#define RNG_H
+
+class Rng {
+public:
+  explicit Rng(unsigned long long seed = 0)
+  {
+    reseed(seed);
+  }
+
+  void reseed(unsigned long long seed)
+  {
+    for(int i = 0; i < 4; ++i) {
+      seed += 0x9E3779B97F4A7C15ULL;
+      unsigned long long z = seed;
+      z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+      z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+      s_[i] = z ^ (z >> 31);
+    }
+  }
+
+  unsigned long long next()
+  {
+    unsigned long long result = rotl(s_[1] * 5, 7) * 9;
+    unsigned long long t = s_[1] << 17;
+
+    s_[2] ^= s_[0];
+    s_[3] ^= s_[1];
+    s_[1] ^= s_[2];
+    s_[0] ^= s_[3];
+    s_[2] ^= t;
+    s_[3] = rotl(s_[3], 45);
+
+    return result;
+  }
+
+  // Uniform integer in [0, n) by multiply-shift on the top 32 bits.
+  int below(int n)
+  {
+    return (int)(((next() >> 32) * (unsigned long long)n) >> 32);
+  }
+
+private:
+  static unsigned long long rotl(unsigned long long x, int k)
+  {
+    return (x << k) | (x >> (64 - k));
+  }
+
+  unsigned long long s_[4];
+};
+
+#endif // RNG_H
@@ -0,0 +1,198 @@
+#include "scheduler.h"
+#include <chrono>
+
+using namespace std;
+
+typedef chrono::steady_clock Clock;
+
+static double secondsSince(Clock::time_point start)
+{
+    return chrono::duration<double>(Clock::now() - start).count();
+}
+
+Scheduler::Scheduler(int threads)
+    : m_generation(0)
+    , m_running(0)
+    , m_quit(false)
+    , m_lastSeconds(0.0)
+{
+    if (threads <= 0)
+    {
+        threads = thread::hardware_concurrency();
+    }
+    if (threads <= 0)
+    {
+        threads = 1;
+    }
+
+    for (int i=0; i<threads; i++)
+    {
+        m_workers.push_back(new Worker());
+    }
+    for (int i=0; i<threads; i++)
+    {
+        m_workers[i]->thread = thread(&Scheduler::workerLoop, this, i);
+    }
+}
+
+Scheduler::~Scheduler()
+{
+    {
+        lock_guard<mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+
+    for (size_t i=0; i<m_workers.size(); i++)
+    {
+        m_workers[i]->thread.join();
+        delete m_workers[i];
+    }
+}
+
+void Scheduler::parallelFor(long count, function<void(int, long)> body)
+{
+    Clock::time_point start = Clock::now();
+    long n = m_workers.size();
+
+    {
+        lock_guard<mutex> lock(m_mutex);
+        for (long i=0; i<n; i++)
+        {
+            Worker& w = *m_workers[i];
+            w.begin = count * i / n;
+            w.end = count * (i+1) / n;
+            w.stats.tasks = 0;
+            w.stats.steals = 0;
+            w.stats.busySeconds = 0.0;
+        }
+        m_body = body;
+        m_running = n;
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    {
+        unique_lock<mutex> lock(m_mutex);
+        m_done.wait(lock, [this] { return m_running == 0; });
+        m_body = nullptr;
+    }
+
+    m_lastSeconds = secondsSince(start);
+}
+
+void Scheduler::workerLoop(int id)
+{
+    long seen = 0;
+
+    while (true)
+    {
+        {
+            unique_lock<mutex> lock(m_mutex);
+            m_wake.wait(lock, [&] { return m_quit || m_generation != seen; });
+            if (m_quit)
+            {
+                return;
+            }
+            seen = m_generation;
+        }
+
+        runTasks(id);
+
+        {
+            lock_guard<mutex> lock(m_mutex);
+            if (--m_running == 0)
+            {
+                m_done.notify_all();
+            }
+        }
+    }
+}
+
+void Scheduler::runTasks(int id)
+{
+    Worker& w = *m_workers[id];
+    long index;
+
+    // Ranges only ever shrink, so once neither our own range nor anybody
+    // else's has anything left there is no more work in this round.
+    while (true)
+    {
+        if (!takeOwn(w, index))
+        {
+            if (!steal(id))
+            {
+                break;
+            }
+            continue;
+        }
+
+        Clock::time_point start = Clock::now();
+        m_body(id, index);
+        w.stats.busySeconds += secondsSince(start);
+        w.stats.tasks++;
+    }
+}
+
+static void spinLock(atomic_flag& lock)
+{
+    while (lock.test_and_set(memory_order_acquire))
+    {
+        this_thread::yield();
+    }
+}
+
+static void spinUnlock(atomic_flag& lock)
+{
+    lock.clear(memory_order_release);
+}
+
+bool Scheduler::takeOwn(Worker& w, long& index)
+{
+    bool got = false;
+
+    spinLock(w.lock);
+    if (w.begin < w.end)
+    {
+        index = w.begin++;
+        got = true;
+    }
+    spinUnlock(w.lock);
+
+    return got;
+}
+
+bool Scheduler::steal(int thief)
+{
+    int n = m_workers.size();
+
+    for (int k=1; k<n; k++)
+    {
+        Worker& victim = *m_workers[(thief + k) % n];
+        long begin = 0, end = 0;
+
+        spinLock(victim.lock);
+        long left = victim.end - victim.begin;
+        if (left > 0)
+        {
+            long take = (left + 1) / 2;
+            end = victim.end;
+            begin = end - take;
+            victim.end = begin;
+        }
+        spinUnlock(victim.lock);
+
+        if (begin < end)
+        {
+            Worker& w = *m_workers[thief];
+            spinLock(w.lock);
+            w.begin = begin;
+            w.end = end;
+            spinUnlock(w.lock);
+            w.stats.steals++;
+            return true;
+        }
+    }
+
+    return false;
+}
@@ -0,0 +1,93 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * Scheduler - Work-stealing thread pool for running many independent
+ * games without the Qt event loop.
+ */
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class Scheduler
+{
+public:
+    // Per-worker counters, reset by every parallelFor().
+    struct WorkerStats
+    {
+        long tasks;         // indices run by this worker
+        long steals;        // successful steals from other workers
+        double busySeconds; // time spent inside the task body
+    };
+
+    // Start a pool with the given number of workers.  Zero means one
+    // per hardware thread.
+    explicit Scheduler(int threads = 0);
+    ~Scheduler();
+
+    int threadCount() const
+    {
+        return (int) m_workers.size();
+    }
+
+    // Run body(worker, index) for every index in [0, count) and return
+    // once all of them have finished.  The range is split evenly between
+    // the workers up front; a worker that runs out steals half of the
+    // remaining range of the next worker along that still has some, so
+    // uneven task lengths do not leave cores idle.
+    void parallelFor(long count, std::function<void(int, long)> body);
+
+    // Wall time of the last parallelFor() and per-worker counters for it.
+    double lastSeconds() const
+    {
+        return m_lastSeconds;
+    }
+    const WorkerStats& stats(int worker) const
+    {
+        return m_workers[worker]->stats;
+    }
+
+private:
+    // A worker owns the half-open index range [begin, end).  It takes
+    // indices from the front; thieves take the back half.  The range is
+    // guarded by a spinlock that is only contended while stealing.
+    struct Worker
+    {
+        std::atomic_flag lock;
+        long begin;
+        long end;
+        WorkerStats stats;
+        std::thread thread;
+
+        Worker() : begin(0), end(0)
+        {
+            lock.clear();
+        }
+    };
+
+    void workerLoop(int id);
+    void runTasks(int id);
+    bool takeOwn(Worker& w, long& index);
+    bool steal(int thief);
+
+    std::vector<Worker*> m_workers;
+
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    std::function<void(int, long)> m_body;
+    long m_generation;
+    int m_running;
+    bool m_quit;
+
+    double m_lastSeconds;
+};
+
+#endif // SCHEDULER_H
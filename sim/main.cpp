@@ -0,0 +1,883 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * Headless simulation runner - plays many independent games on all
+ * cores, with no window and no QApplication, and reports throughput.
+ */
+
+#include "autoplayer.h"
+#include "basicgame.h"
+#include "game.h"
+#include "movegen.h"
+#include "replay.h"
+#include "scheduler.h"
+#include "trace.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+struct Options
+{
+    long games;
+    int threads;
+    int width;
+    int height;
+    unsigned long long seed;
+    long maxTicks;
+    Game::Randomizer randomizer;
+    int perft;
+    bool autoplay;
+    bool deltas;
+    bool compare;
+    bool checkDeltas;
+    bool checkMoves;
+    bool sweep;
+    const char *record;
+    vector<const char *> replays;
+    int repeat;
+    const char *trace;
+};
+
+// Totals gathered by one worker.  Padded to a cache line so workers do
+// not share lines while counting.
+struct alignas(64) Totals
+{
+    long games;
+    long ticks;
+    long lines[5];
+    long long evaluations;
+    long long deltaCells;
+};
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [--games N] [--threads N] [--width N] [--height N]\n"
+            "          [--seed N] [--max-ticks N] [--bag] [--ai] [--deltas]\n"
+            "          [--record FILE] [--perft DEPTH] [--compare] [--sweep]\n"
+            "          [--check-deltas] [--check-moves]\n"
+            "          [--trace FILE]\n"
+            "       %s --replay FILE [--replay FILE ...] [--repeat N] [--threads N]\n",
+            argv0, argv0);
+    exit(1);
+}
+
+static Options parseOptions(int argc, char *argv[])
+{
+    Options opt;
+    opt.games = 100000;
+    opt.threads = 0;
+    opt.width = 10;
+    opt.height = 24;
+    opt.seed = 1;
+    opt.maxTicks = 100000;
+    opt.randomizer = Game::RANDOM_UNIFORM;
+    opt.perft = 0;
+    opt.autoplay = false;
+    opt.deltas = false;
+    opt.compare = false;
+    opt.checkDeltas = false;
+    opt.checkMoves = false;
+    opt.sweep = false;
+    opt.record = 0;
+    opt.repeat = 1;
+    opt.trace = 0;
+
+    for (int i=1; i<argc; i++)
+    {
+        if (!strcmp(argv[i], "--bag"))
+        {
+            opt.randomizer = Game::RANDOM_BAG;
+            continue;
+        }
+        if (!strcmp(argv[i], "--ai"))
+        {
+            opt.autoplay = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--deltas"))
+        {
+            opt.deltas = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--compare"))
+        {
+            opt.compare = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--check-deltas"))
+        {
+            opt.checkDeltas = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--check-moves"))
+        {
+            opt.checkMoves = true;
+            continue;
+        }
+        if (!strcmp(argv[i], "--sweep"))
+        {
+            opt.sweep = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+        }
+        const char *arg = argv[i];
+        const char *val = argv[++i];
+
+        if (!strcmp(arg, "--games"))
+            opt.games = atol(val);
+        else if (!strcmp(arg, "--threads"))
+            opt.threads = atoi(val);
+        else if (!strcmp(arg, "--width"))
+            opt.width = atoi(val);
+        else if (!strcmp(arg, "--height"))
+            opt.height = atoi(val);
+        else if (!strcmp(arg, "--seed"))
+            opt.seed = strtoull(val, 0, 10);
+        else if (!strcmp(arg, "--max-ticks"))
+            opt.maxTicks = atol(val);
+        else if (!strcmp(arg, "--perft"))
+            opt.perft = atoi(val);
+        else if (!strcmp(arg, "--record"))
+            opt.record = val;
+        else if (!strcmp(arg, "--replay"))
+            opt.replays.push_back(val);
+        else if (!strcmp(arg, "--repeat"))
+            opt.repeat = atoi(val);
+        else if (!strcmp(arg, "--trace"))
+            opt.trace = val;
+        else
+            usage(argv[0]);
+    }
+
+    // The rates divide by both
+    if (opt.games < 1 || opt.repeat < 1)
+        usage(argv[0]);
+
+    // Replays can only hold wells up to the game's limit
+    if (opt.width < 1 || opt.height < 1 ||
+        opt.width > Game::MAX_WIDTH || opt.height > Game::MAX_HEIGHT)
+    {
+        fprintf(stderr, "the well must be from 1x1 to %dx%d\n",
+                Game::MAX_WIDTH, Game::MAX_HEIGHT);
+        exit(1);
+    }
+
+    // The autoplayer's boards hold one word per row, and its features
+    // only mean something in a well as wide as a flat I piece
+    if (opt.autoplay && (opt.width < 4 || opt.width > 64))
+    {
+        fprintf(stderr, "--ai needs a well 4 to 64 columns wide\n");
+        usage(argv[0]);
+    }
+
+    return opt;
+}
+
+// xorshift64* - a tiny generator for the random input policy, seeded
+// per game so a game's inputs do not depend on which thread ran it.
+static unsigned long long nextRandom(unsigned long long& state)
+{
+    state ^= state >> 12;
+    state ^= state << 25;
+    state ^= state >> 27;
+    return state * 2685821657736338717ULL;
+}
+
+// The inputs the random policy chooses from.
+static const Game::Move RANDOM_MOVES[] = {
+    Game::MOVE_LEFT, Game::MOVE_RIGHT, Game::MOVE_CW, Game::MOVE_CCW,
+    Game::MOVE_DROP
+};
+
+// Collect the tick's changes the way the window does for the renderer,
+// if asked to, and count them.
+static void takeDelta(Game& game, GameDelta *delta, Totals& totals)
+{
+    if (delta)
+    {
+        game.takeDelta(*delta);
+        totals.deltaCells += delta->cells.size();
+    }
+}
+
+// Play one game to the end with random inputs, roughly what a human
+// mashing keys does: a move or rotation on most ticks, a hard drop on
+// some.  Both the pieces and the inputs depend only on the seed, so a
+// game plays out the same whichever thread runs it.  If replay is set
+// the game is recorded into it.
+static void playRandomGame(Game& game, GameDelta *delta, ReplayWriter *replay,
+                           unsigned long long seed, long maxTicks,
+                           Totals& totals)
+{
+    unsigned long long state = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    game.reset(seed);
+    if (replay)
+        replay->begin(game, seed);
+
+    for (long t=0; t<maxTicks; t++)
+    {
+        int input = nextRandom(state) % 8;
+        if (input < 5)
+        {
+            game.apply(RANDOM_MOVES[input]);
+            if (replay)
+                replay->move(RANDOM_MOVES[input], 0);
+        }
+
+        int result = game.tick();
+        if (replay)
+            replay->tick(game, 0);
+        takeDelta(game, delta, totals);
+        totals.ticks++;
+        if (result < 0)
+        {
+            break;
+        }
+        totals.lines[result]++;
+    }
+
+    if (replay)
+        replay->end(game, 0);
+    totals.games++;
+}
+
+// Play one game with the autoplayer choosing where every piece goes.
+// Its moves leave the piece at rest, so each tick locks a piece.
+static void playAutoGame(Game& game, GameDelta *delta, ReplayWriter *replay,
+                         AutoPlayer& player, unsigned long long seed,
+                         long maxTicks, Totals& totals)
+{
+    long long evaluations = player.getEvaluations();
+
+    game.reset(seed);
+    if (replay)
+        replay->begin(game, seed);
+
+    for (long t=0; t<maxTicks; t++)
+    {
+        player.play(game);
+        if (replay)
+        {
+            const vector<Game::Move>& path = player.getLastPath();
+            for (size_t i=0; i<path.size(); i++)
+                replay->move(path[i], 0);
+        }
+
+        int result = game.tick();
+        if (replay)
+            replay->tick(game, 0);
+        takeDelta(game, delta, totals);
+        totals.ticks++;
+        if (result < 0)
+        {
+            break;
+        }
+        totals.lines[result]++;
+    }
+
+    if (replay)
+        replay->end(game, 0);
+    totals.evaluations += player.getEvaluations() - evaluations;
+    totals.games++;
+}
+
+// The random game above with nothing else going on, for either kind of
+// game.  Returns the checksum of the final state.
+template<class G>
+static unsigned long long playPlainGame(G& game, unsigned long long seed,
+                                        long maxTicks, Totals& totals)
+{
+    unsigned long long state = seed * 0x9E3779B97F4A7C15ULL + 1;
+
+    game.reset(seed);
+    for (long t=0; t<maxTicks; t++)
+    {
+        int input = nextRandom(state) % 8;
+        if (input < 5)
+            game.apply(RANDOM_MOVES[input]);
+
+        int result = game.tick();
+        totals.ticks++;
+        if (result < 0)
+            break;
+        totals.lines[result]++;
+    }
+
+    totals.games++;
+    return game.getChecksum();
+}
+
+// Play the same random games on the runtime-sized Game and on
+// BasicGame<W, H>, time both and check they ended up identical.
+template<int W, int H>
+static int runCompare(const Options& opt)
+{
+    Scheduler scheduler(opt.threads);
+    int threads = scheduler.threadCount();
+
+    vector<unique_ptr<Game> > games(threads);
+    vector<unique_ptr<BasicGame<W, H> > > fixed(threads);
+    vector<Totals> totals(threads);
+    for (int i=0; i<threads; i++)
+    {
+        games[i].reset(new Game(W, H, opt.seed, opt.randomizer));
+        fixed[i].reset(new BasicGame<W, H>(opt.seed, opt.randomizer));
+    }
+    vector<unsigned long long> checksums(opt.games);
+    long mismatches = 0;
+    double seconds[2];
+    long ticks[2];
+
+    for (int pass=0; pass<2; pass++)
+    {
+        for (int i=0; i<threads; i++)
+            memset(&totals[i], 0, sizeof(Totals));
+
+        scheduler.parallelFor(opt.games, [&](int worker, long index) {
+            unsigned long long seed = opt.seed + index;
+            if (pass == 0)
+            {
+                checksums[index] = playPlainGame(*games[worker], seed,
+                                                 opt.maxTicks, totals[worker]);
+            }
+            else if (playPlainGame(*fixed[worker], seed, opt.maxTicks,
+                                   totals[worker]) != checksums[index])
+            {
+                __atomic_add_fetch(&mismatches, 1, __ATOMIC_RELAXED);
+            }
+        });
+
+        seconds[pass] = scheduler.lastSeconds();
+        ticks[pass] = 0;
+        for (int i=0; i<threads; i++)
+            ticks[pass] += totals[i].ticks;
+    }
+
+    printf("games:      %ld on %dx%d, %d threads\n",
+           opt.games, W, H, threads);
+    printf("Game:             %12.0f ticks/sec  %.3f s\n",
+           ticks[0] / seconds[0], seconds[0]);
+    printf("BasicGame<%d,%d>: %12.0f ticks/sec  %.3f s  (%.2fx)\n",
+           W, H, ticks[1] / seconds[1], seconds[1], seconds[0] / seconds[1]);
+    printf("mismatches: %ld\n", mismatches);
+
+    return mismatches ? 1 : 0;
+}
+
+// The sizes BasicGame is built for here.  Any other size only exists
+// as a runtime Game.
+static int runCompare(const Options& opt)
+{
+    if (opt.width == 10 && opt.height == 20)
+        return runCompare<10, 20>(opt);
+    if (opt.width == 10 && opt.height == 24)
+        return runCompare<10, 24>(opt);
+    if (opt.width == 16 && opt.height == 32)
+        return runCompare<16, 32>(opt);
+    fprintf(stderr, "--compare supports 10x20, 10x24 and 16x32 wells\n");
+    return 1;
+}
+
+// Where piece p would come to rest dropped straight down with its box
+// at column x, judged from the column heights alone, and how many empty
+// cells it would leave under itself.  Returns false if p does not fit
+// in the well there.
+static bool settle(const Game& game, const Piece& p, int x, int& y, int& gaps)
+{
+    if (x + p.getLeftMargin() < 0 ||
+        x + 3 - p.getRightMargin() >= game.getWidth())
+        return false;
+
+    y = 3 - p.getBottomMargin();
+    for (int c=0; c<4; c++)
+    {
+        int bottom = p.getColumnBottom(c);
+        if (bottom >= 0)
+            y = max(y, game.getColumnHeight(x + c) + bottom);
+    }
+    gaps = 0;
+    for (int c=0; c<4; c++)
+    {
+        int bottom = p.getColumnBottom(c);
+        if (bottom >= 0)
+            gaps += y - bottom - game.getColumnHeight(x + c);
+    }
+    return true;
+}
+
+// Play one game with a greedy policy that packs well enough to clear
+// rows in any width: every piece tries every column in each orientation
+// and goes where it leaves the fewest gaps, lowest down.  Choosing looks
+// at every column, so the time it takes is kept out of the engine's
+// time; calls counts every move and tick the engine is asked for.
+static void playSweepGame(Game& game, unsigned long long seed, long maxTicks,
+                          Totals& totals, long& calls, double& policySeconds)
+{
+    int width = game.getWidth();
+
+    game.reset(seed);
+    for (long t=0; t<maxTicks; t++)
+    {
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        Piece p = game.getPiece();
+        int bestScore = 1 << 30, bestRot = 0, bestX = game.getPieceX();
+        for (int rot=0; rot<4; rot++)
+        {
+            Piece q(p.getType(), rot);
+            for (int x=-3; x<width; x++)
+            {
+                int y, gaps;
+                if (settle(game, q, x, y, gaps) && gaps * 64 + y < bestScore)
+                {
+                    bestScore = gaps * 64 + y;
+                    bestRot = rot;
+                    bestX = x;
+                }
+            }
+        }
+        policySeconds += chrono::duration<double>(
+            chrono::steady_clock::now() - start).count();
+
+        for (int rot=0; rot<bestRot; rot++, calls++)
+            game.rotateCW();
+        while (game.getPieceX() < bestX && game.moveRight())
+            calls++;
+        while (game.getPieceX() > bestX && game.moveLeft())
+            calls++;
+        game.drop();
+
+        int result = game.tick();
+        calls += 2;
+        totals.ticks++;
+        if (result < 0)
+            break;
+        totals.lines[result]++;
+    }
+
+    totals.games++;
+}
+
+// Time the engine over a range of well widths at the given height.
+// The figure to watch is ns/call, which should not grow with the width;
+// ns/piece includes the moves across the well, which do.
+static int runSweep(const Options& opt)
+{
+    static const int WIDTHS[] = { 10, 16, 32, 64, 128, 256, 512, 1024 };
+
+    Scheduler scheduler(opt.threads);
+    int threads = scheduler.threadCount();
+    vector<Totals> totals(threads);
+    vector<long> calls(threads);
+    vector<double> policySeconds(threads);
+
+    printf("height %d, %ld games per width, %d threads\n",
+           opt.height, opt.games, threads);
+    printf(" width  pieces/sec   calls/sec  ns/call  ns/piece  lines/piece\n");
+
+    for (size_t w=0; w<sizeof(WIDTHS)/sizeof(WIDTHS[0]); w++)
+    {
+        int width = WIDTHS[w];
+        vector<unique_ptr<Game> > games(threads);
+        for (int i=0; i<threads; i++)
+        {
+            games[i].reset(new Game(width, opt.height, opt.seed,
+                                    opt.randomizer));
+            memset(&totals[i], 0, sizeof(Totals));
+            calls[i] = 0;
+            policySeconds[i] = 0;
+        }
+
+        scheduler.parallelFor(opt.games, [&](int worker, long index) {
+            playSweepGame(*games[worker], opt.seed + index, opt.maxTicks,
+                          totals[worker], calls[worker],
+                          policySeconds[worker]);
+        });
+
+        // Engine time per thread, less the time spent choosing moves
+        double seconds = scheduler.lastSeconds() * threads;
+        long ticks = 0, lines = 0, allCalls = 0;
+        for (int i=0; i<threads; i++)
+        {
+            seconds -= policySeconds[i];
+            ticks += totals[i].ticks;
+            allCalls += calls[i];
+            for (int k=1; k<=4; k++)
+                lines += k * totals[i].lines[k];
+        }
+        printf("%6d %11.0f %11.0f %8.2f %9.1f %12.3f\n", width,
+               ticks * threads / seconds, allCalls * threads / seconds,
+               1e9 * seconds / allCalls, 1e9 * seconds / ticks,
+               (double) lines / ticks);
+    }
+
+    return 0;
+}
+
+// Count the positions reachable from the start of a game, one depth at
+// a time, and time the move generator doing it.
+static int runPerft(const Options& opt)
+{
+    Game game(opt.width, opt.height, opt.seed, opt.randomizer);
+    MoveGen gen;
+
+    for (int depth=1; depth<=opt.perft; depth++)
+    {
+        long long searches = gen.getSearchCount();
+        chrono::steady_clock::time_point start = chrono::steady_clock::now();
+        long long count = gen.perft(game, depth);
+        double seconds = chrono::duration<double>(
+            chrono::steady_clock::now() - start).count();
+        searches = gen.getSearchCount() - searches;
+
+        printf("perft %d: %12lld positions  %8.3f s  %10.0f positions/s"
+               "  %6.2f us/search\n", depth, count, seconds,
+               count / seconds, 1e6 * seconds / searches);
+    }
+
+    return 0;
+}
+
+// Play random games with undo mixed in, keeping a copy of the board
+// built only from deltas, and check it against the game after every
+// delta.  Returns the number of games where the two ever differed.
+static int runCheckDeltas(const Options& opt)
+{
+    Scheduler scheduler(opt.threads);
+    int threads = scheduler.threadCount();
+    int rows = opt.height + 4;
+
+    vector<unique_ptr<Game> > games(threads);
+    vector<GameDelta> deltas(threads);
+    vector<vector<int> > shadows(threads);
+    for (int i=0; i<threads; i++)
+        games[i].reset(new Game(opt.width, opt.height, opt.seed,
+                                opt.randomizer));
+    long failed = 0;
+
+    scheduler.parallelFor(opt.games, [&](int worker, long index) {
+        Game& game = *games[worker];
+        GameDelta& delta = deltas[worker];
+        vector<int>& shadow = shadows[worker];
+        unsigned long long state = (opt.seed + index) * 0x9E3779B97F4A7C15ULL + 1;
+
+        // A reset lists every cell in the next delta
+        game.reset(opt.seed + index);
+        shadow.assign(rows * opt.width, -2);
+
+        for (long t=0; t<opt.maxTicks; t++)
+        {
+            int input = nextRandom(state) % 10;
+            if (input < 5)
+                game.apply(RANDOM_MOVES[input]);
+            else if (input == 5)
+                game.pushUndo();
+            else if (input == 6)
+                game.popUndo();
+            if (input >= 7 && game.tick() < 0)
+                break;
+
+            game.takeDelta(delta);
+            for (size_t i=0; i<delta.cells.size(); i++)
+            {
+                const GameDelta::Cell& cell = delta.cells[i];
+                shadow[cell.row * opt.width + cell.col] = cell.value;
+            }
+            for (int r=0; r<rows; r++)
+            {
+                for (int c=0; c<opt.width; c++)
+                {
+                    if (shadow[r * opt.width + c] != game.get(r, c))
+                    {
+                        fprintf(stderr, "game %ld step %ld: r%d c%d is %d "
+                                "in the deltas, %d in the game\n", index, t,
+                                r, c, shadow[r * opt.width + c], game.get(r, c));
+                        __atomic_add_fetch(&failed, 1, __ATOMIC_RELAXED);
+                        return;
+                    }
+                }
+            }
+        }
+    });
+
+    printf("checked:    %ld games on %dx%d, %.3f s\n",
+           opt.games, opt.width, opt.height, scheduler.lastSeconds());
+    printf("mismatched: %ld\n", failed);
+    return failed ? 1 : 0;
+}
+
+// Play games by picking placements from the move generator at random,
+// and walk every placement it offers through a copy of the game: each
+// path must be legal and end with the piece at rest where reported.
+// Besides the --width well this runs on wells of 1 to 3 columns, which
+// some orientations are too wide for.  Returns the number of games with
+// a bad placement.
+static int runCheckMoves(const Options& opt)
+{
+    Scheduler scheduler(opt.threads);
+    int threads = scheduler.threadCount();
+
+    vector<int> widths;
+    for (int w=1; w<=3; w++)
+        widths.push_back(w);
+    if (opt.width > 3 && opt.width <= 64)
+        widths.push_back(opt.width);
+
+    vector<MoveGen> gens(threads);
+    vector<vector<Placement> > placements(threads);
+    vector<vector<Game::Move> > paths(threads);
+    vector<Board> boards(threads);
+    vector<unique_ptr<Game> > copies(threads);
+    long failed = 0, checked = 0;
+
+    for (size_t k=0; k<widths.size(); k++)
+    {
+        int width = widths[k];
+        scheduler.parallelFor(opt.games, [&](int worker, long index) {
+            MoveGen& gen = gens[worker];
+            vector<Placement>& out = placements[worker];
+            vector<Game::Move>& path = paths[worker];
+            Board& board = boards[worker];
+            unsigned long long state = (opt.seed + index) * 0x9E3779B97F4A7C15ULL + 1;
+            Game game(width, opt.height, opt.seed + index, opt.randomizer);
+            if (!copies[worker])
+                copies[worker].reset(new Game(game));
+            Game& copy = *copies[worker];
+            long count = 0;
+
+            for (long t=0; t<opt.maxTicks && !game.isOver(); t++)
+            {
+                // In a narrow well the piece can spawn overlapping a
+                // wall, with nowhere to go; the next tick ends the game.
+                int n = gen.generate(game, out);
+                if (n == 0)
+                {
+                    board.load(game);
+                    if (board.fits(game.getPiece(), game.getPieceX(),
+                                   game.getPieceY()))
+                    {
+                        fprintf(stderr, "%d wide, game %ld piece %ld: no "
+                                "placements\n", width, index, t);
+                        __atomic_add_fetch(&failed, 1, __ATOMIC_RELAXED);
+                        return;
+                    }
+                    break;
+                }
+
+                for (int i=0; i<n; i++)
+                {
+                    const Placement& p = out[i];
+                    copy = game;
+                    gen.getPath(p, path);
+                    bool legal = true;
+                    for (size_t m=0; m<path.size(); m++)
+                        legal = legal && copy.apply(path[m]);
+                    if (!legal || copy.getPiece().getType() != p.piece.getType() ||
+                        copy.getPiece().getRotation() != p.piece.getRotation() ||
+                        copy.getPieceX() != p.x || copy.getPieceY() != p.y ||
+                        copy.moveDown())
+                    {
+                        fprintf(stderr, "%d wide, game %ld piece %ld: "
+                                "placement r%d x%d y%d is not reached\n",
+                                width, index, t, p.piece.getRotation(),
+                                p.x, p.y);
+                        __atomic_add_fetch(&failed, 1, __ATOMIC_RELAXED);
+                        return;
+                    }
+                }
+                count += n;
+
+                gen.getPath(out[nextRandom(state) % n], path);
+                for (size_t m=0; m<path.size(); m++)
+                    game.apply(path[m]);
+                if (game.tick() < 0)
+                    break;
+            }
+            __atomic_add_fetch(&checked, count, __ATOMIC_RELAXED);
+        });
+    }
+
+    printf("checked:    %ld placements in %ld games on each of",
+           checked, opt.games);
+    for (size_t k=0; k<widths.size(); k++)
+        printf(" %dx%d", widths[k], opt.height);
+    printf("\n");
+    printf("mismatched: %ld\n", failed);
+    return failed ? 1 : 0;
+}
+
+// Re-simulate recorded games as fast as possible, checking each against
+// the states recorded in it, and time the lot.  Files are spread over
+// the workers; --repeat plays the whole set several times over.
+static int runReplays(const Options& opt)
+{
+    Scheduler scheduler(opt.threads);
+    int files = opt.replays.size();
+    vector<long> ticks(files), moves(files), keyframes(files);
+    vector<const char *> errors(files);
+
+    scheduler.parallelFor((long) files * opt.repeat, [&](int, long index) {
+        int f = index % files;
+        ReplayPlayer player;
+        if (!player.open(opt.replays[f]))
+        {
+            errors[f] = player.getError();
+            return;
+        }
+        Game game(player.getWidth(), player.getHeight());
+        if (!player.run(game))
+            errors[f] = player.getError();
+        if (index < files)
+        {
+            ticks[f] = player.getTicks();
+            moves[f] = player.getMoves();
+            keyframes[f] = player.getKeyframes();
+        }
+    });
+
+    double seconds = scheduler.lastSeconds();
+    long totalTicks = 0;
+    int failed = 0;
+    for (int f=0; f<files; f++)
+    {
+        if (errors[f])
+        {
+            printf("%s: FAILED: %s\n", opt.replays[f], errors[f]);
+            failed++;
+        }
+        else
+        {
+            printf("%s: ok, %ld ticks, %ld moves, %ld keyframes\n",
+                   opt.replays[f], ticks[f], moves[f], keyframes[f]);
+        }
+        totalTicks += ticks[f];
+    }
+    printf("replays:    %d x %d on %d threads, %.3f s\n",
+           files, opt.repeat, scheduler.threadCount(), seconds);
+    printf("ticks/sec:  %.0f\n", totalTicks * opt.repeat / seconds);
+
+    return failed ? 1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt = parseOptions(argc, argv);
+    if (opt.perft > 0)
+    {
+        return runPerft(opt);
+    }
+    if (!opt.replays.empty())
+    {
+        return runReplays(opt);
+    }
+    if (opt.compare)
+    {
+        return runCompare(opt);
+    }
+    if (opt.checkDeltas)
+    {
+        return runCheckDeltas(opt);
+    }
+    if (opt.checkMoves)
+    {
+        return runCheckMoves(opt);
+    }
+    if (opt.sweep)
+    {
+        return runSweep(opt);
+    }
+
+    Scheduler scheduler(opt.threads);
+    int threads = scheduler.threadCount();
+
+    // One Game per worker, reset between games rather than reallocated.
+    vector<unique_ptr<Game> > games(threads);
+    vector<AutoPlayer> players(threads);
+    vector<GameDelta> deltas(threads);
+    ReplayWriter recording;
+    vector<Totals> totals(threads);
+    for (int i=0; i<threads; i++)
+    {
+        games[i].reset(new Game(opt.width, opt.height, opt.seed,
+                                opt.randomizer));
+        memset(&totals[i], 0, sizeof(Totals));
+    }
+
+    scheduler.parallelFor(opt.games, [&](int worker, long index) {
+        TRACE_SCOPE("game");
+        GameDelta *delta = opt.deltas ? &deltas[worker] : 0;
+        ReplayWriter *replay = opt.record && index == 0 ? &recording : 0;
+        if (opt.autoplay)
+            playAutoGame(*games[worker], delta, replay, players[worker],
+                         opt.seed + index, opt.maxTicks, totals[worker]);
+        else
+            playRandomGame(*games[worker], delta, replay, opt.seed + index,
+                           opt.maxTicks, totals[worker]);
+    });
+
+    if (opt.record && !recording.save(opt.record))
+    {
+        fprintf(stderr, "cannot write %s\n", opt.record);
+        return 1;
+    }
+    if (opt.trace && !traceWrite(opt.trace))
+    {
+        fprintf(stderr, "cannot write %s (tracing needs qmake CONFIG+=trace)\n",
+                opt.trace);
+        return 1;
+    }
+
+    double seconds = scheduler.lastSeconds();
+    Totals sum;
+    memset(&sum, 0, sizeof(sum));
+    for (int i=0; i<threads; i++)
+    {
+        sum.games += totals[i].games;
+        sum.ticks += totals[i].ticks;
+        sum.evaluations += totals[i].evaluations;
+        sum.deltaCells += totals[i].deltaCells;
+        for (int k=1; k<=4; k++)
+        {
+            sum.lines[k] += totals[i].lines[k];
+        }
+    }
+
+    printf("games:      %ld on %dx%d, %d threads, %.3f s\n",
+           sum.games, opt.width, opt.height, threads, seconds);
+    printf("games/sec:  %.0f\n", sum.games / seconds);
+    printf("ticks/sec:  %.0f\n", sum.ticks / seconds);
+    if (opt.autoplay)
+    {
+        printf("evals/sec:  %.0f\n", sum.evaluations / seconds);
+    }
+    if (opt.deltas)
+    {
+        printf("cells/tick: %.2f changed of %d\n",
+               (double) sum.deltaCells / sum.ticks, opt.width * opt.height);
+    }
+    printf("line clears:");
+    for (int k=1; k<=4; k++)
+    {
+        printf("  %dx %ld", k, sum.lines[k]);
+    }
+    printf("\n");
+
+    for (int i=0; i<threads; i++)
+    {
+        const Scheduler::WorkerStats& st = scheduler.stats(i);
+        printf("thread %2d:  %8ld games  %4ld steals  %5.1f%% busy\n",
+               i, st.tasks, st.steals, 100.0 * st.busySeconds / seconds);
+    }
+
+    return 0;
+}
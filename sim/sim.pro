@@ -0,0 +1,18 @@
+######################################################################
+# Headless simulation runner - drives Game without Qt
+######################################################################
+
+TEMPLATE = app
+TARGET = sim
+CONFIG += console c++14 thread
+CONFIG -= qt app_bundle
+INCLUDEPATH += ..
+
+# Input
+HEADERS += ../autoplayer.h ../basicgame.h ../game.h ../movegen.h ../pieces.h ../replay.h ../rng.h ../scheduler.h ../trace.h
+SOURCES += main.cpp ../autoplayer.cpp ../game.cpp ../movegen.cpp ../replay.cpp ../scheduler.cpp ../trace.cpp
+
+# qmake CONFIG+=trace builds in TRACE_SCOPE timing (--trace FILE)
+trace {
+    DEFINES += TRACE_ENABLED
+}
@@ -0,0 +1,71 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * SpscQueue - Bounded lock-free queue for exactly one producer thread
+ * and one consumer thread.  Neither side ever waits for the other: a
+ * push to a full queue or a pop from an empty one just fails.
+ */
+
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+
+// N must be a power of two.  T is copied in and out of its slot.
+template<class T, int N>
+class SpscQueue
+{
+    static_assert(N > 0 && (N & (N - 1)) == 0, "size must be a power of two");
+
+public:
+    SpscQueue() : m_head(0), m_tailCache(0), m_tail(0), m_headCache(0)
+    {
+    }
+
+    // Producer only.  Returns false, leaving the queue alone, if it is
+    // full.
+    bool push(const T &item)
+    {
+        size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_headCache == (size_t) N)
+        {
+            m_headCache = m_head.load(std::memory_order_acquire);
+            if (tail - m_headCache == (size_t) N)
+                return false;
+        }
+        m_items[tail & (N - 1)] = item;
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer only.  Returns false if there is nothing to take.
+    bool pop(T &item)
+    {
+        size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_tailCache)
+        {
+            m_tailCache = m_tail.load(std::memory_order_acquire);
+            if (head == m_tailCache)
+                return false;
+        }
+        item = m_items[head & (N - 1)];
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+private:
+    // Each side's index and its cached copy of the other side's index
+    // share a cache line of their own, so the two threads only touch
+    // each other's line when the cached copy runs out.
+    alignas(64) std::atomic<size_t> m_head;
+    size_t m_tailCache;
+
+    alignas(64) std::atomic<size_t> m_tail;
+    size_t m_headCache;
+
+    alignas(64) T m_items[N];
+};
+
+#endif // SPSCQUEUE_H
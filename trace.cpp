@@ -0,0 +1,183 @@
+#include "trace.h"
+
+#ifdef TRACE_ENABLED
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+// Events kept per thread; older ones are overwritten.
+const unsigned long CAPACITY = 1 << 16;
+
+// Slots are written by their thread and read by traceWrite() on
+// another, so every field is atomic; relaxed accesses compile to plain
+// loads and stores.
+struct Slot
+{
+    atomic<const char *> name;
+    atomic<unsigned long long> start;
+    atomic<unsigned long long> end;
+};
+
+struct Buffer
+{
+    Slot slots[CAPACITY];
+    // Events written so far; slot head % CAPACITY is next.
+    atomic<unsigned long> head;
+    atomic<const char *> threadName;
+    int tid;
+    Buffer *next;
+};
+
+// Every thread's buffer, newest first.  Buffers are never freed, so a
+// thread's events can still be written out after it has finished.
+atomic<Buffer *> buffers(0);
+atomic<int> nextTid(1);
+
+const chrono::steady_clock::time_point epoch = chrono::steady_clock::now();
+
+thread_local Buffer *local = 0;
+
+Buffer *localBuffer()
+{
+    if (!local)
+    {
+        Buffer *b = new Buffer();
+        b->head.store(0, memory_order_relaxed);
+        b->threadName.store(0, memory_order_relaxed);
+        b->tid = nextTid.fetch_add(1, memory_order_relaxed);
+        b->next = buffers.load(memory_order_relaxed);
+        while (!buffers.compare_exchange_weak(b->next, b,
+                                              memory_order_release,
+                                              memory_order_relaxed))
+        {
+        }
+        local = b;
+    }
+    return local;
+}
+
+// Names come from the source, but keep the JSON well formed whatever
+// they hold.
+void writeString(FILE *f, const char *s)
+{
+    fputc('"', f);
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', f);
+        if ((unsigned char) *s >= ' ')
+            fputc(*s, f);
+    }
+    fputc('"', f);
+}
+
+} // namespace
+
+unsigned long long traceNow()
+{
+    return chrono::duration_cast<chrono::nanoseconds>(
+        chrono::steady_clock::now() - epoch).count();
+}
+
+void traceEvent(const char *name, unsigned long long start,
+                unsigned long long end)
+{
+    Buffer *b = localBuffer();
+    unsigned long head = b->head.load(memory_order_relaxed);
+    Slot &slot = b->slots[head % CAPACITY];
+    slot.name.store(name, memory_order_relaxed);
+    slot.start.store(start, memory_order_relaxed);
+    slot.end.store(end, memory_order_relaxed);
+    b->head.store(head + 1, memory_order_release);
+}
+
+void traceThreadName(const char *name)
+{
+    localBuffer()->threadName.store(name, memory_order_relaxed);
+}
+
+bool traceWrite(const char *path)
+{
+    FILE *f = fopen(path, "w");
+    if (!f)
+        return false;
+
+    fprintf(f, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    bool first = true;
+
+    struct Event
+    {
+        const char *name;
+        unsigned long long start;
+        unsigned long long end;
+    };
+    vector<Event> events;
+
+    for (Buffer *b = buffers.load(memory_order_acquire); b; b = b->next)
+    {
+        const char *threadName = b->threadName.load(memory_order_relaxed);
+        if (threadName)
+        {
+            fprintf(f, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,"
+                       "\"tid\":%d,\"args\":{\"name\":", first ? "" : ",\n",
+                    b->tid);
+            writeString(f, threadName);
+            fprintf(f, "}}");
+            first = false;
+        }
+
+        // Copy the slots, then drop any the thread may have started
+        // overwriting meanwhile: with one writer, a slot is intact if
+        // the writer had not yet gone a whole lap past it.
+        unsigned long head = b->head.load(memory_order_acquire);
+        unsigned long begin = head > CAPACITY ? head - CAPACITY : 0;
+        events.clear();
+        for (unsigned long i = begin; i < head; i++)
+        {
+            const Slot &slot = b->slots[i % CAPACITY];
+            Event e;
+            e.name = slot.name.load(memory_order_relaxed);
+            e.start = slot.start.load(memory_order_relaxed);
+            e.end = slot.end.load(memory_order_relaxed);
+            events.push_back(e);
+        }
+        atomic_thread_fence(memory_order_acquire);
+        unsigned long after = b->head.load(memory_order_relaxed);
+        unsigned long valid = after >= CAPACITY ? after - CAPACITY + 1 : 0;
+
+        for (unsigned long i = max(begin, valid); i < head; i++)
+        {
+            const Event &e = events[i - begin];
+            fprintf(f, "%s{\"name\":", first ? "" : ",\n");
+            writeString(f, e.name);
+            fprintf(f, ",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,"
+                       "\"dur\":%.3f}",
+                    b->tid, e.start / 1000.0, (e.end - e.start) / 1000.0);
+            first = false;
+        }
+    }
+
+    fprintf(f, "\n]}\n");
+    bool ok = !ferror(f);
+    return fclose(f) == 0 && ok;
+}
+
+#else
+
+void traceThreadName(const char *)
+{
+}
+
+bool traceWrite(const char *)
+{
+    return false;
+}
+
+#endif // TRACE_ENABLED
@@ -0,0 +1,68 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * Trace - Scoped timing events for finding out where a stutter comes
+ * from.  TRACE_SCOPE("name") records when the enclosing scope started
+ * and how long it took.  Every thread writes its own ring buffer, with
+ * no locks and no allocation after its first event, and keeps only the
+ * latest events; traceWrite() saves them all as a Chrome trace (load
+ * it in chrome://tracing or ui.perfetto.dev).
+ *
+ * Tracing is compiled in only when TRACE_ENABLED is defined (qmake
+ * CONFIG+=trace); otherwise TRACE_SCOPE expands to nothing and
+ * traceWrite() fails.
+ */
+
+#ifndef TRACE_H
+#define TRACE_H
+
+// Name the calling thread in the trace.  The name must outlive it.
+void traceThreadName(const char *name);
+
+// Save the events of every thread to path as Chrome trace JSON.  Safe
+// to call while other threads are tracing; events they overwrite while
+// it runs are left out.  Returns false if tracing is compiled out or
+// the file cannot be written.
+bool traceWrite(const char *path);
+
+#ifdef TRACE_ENABLED
+
+// Time since the trace began, in nanoseconds.
+unsigned long long traceNow();
+
+// Record an event on the calling thread.  name must be a string
+// literal or otherwise live as long as the program.
+void traceEvent(const char *name, unsigned long long start,
+                unsigned long long end);
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *name) : m_name(name), m_start(traceNow())
+    {
+    }
+    ~TraceScope()
+    {
+        traceEvent(m_name, m_start, traceNow());
+    }
+
+private:
+    TraceScope(const TraceScope &);
+    TraceScope &operator=(const TraceScope &);
+
+    const char *m_name;
+    unsigned long long m_start;
+};
+
+#define TRACE_CONCAT2(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT2(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(traceScope, __LINE__)(name)
+
+#else
+
+#define TRACE_SCOPE(name) ((void) 0)
+
+#endif // TRACE_ENABLED
+
+#endif // TRACE_H
@@ -0,0 +1,68 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * TripleBuffer - Hands the latest of a stream of values from one writer
+ * thread to one reader thread without either waiting.  The writer fills
+ * its back buffer and publishes it; the reader picks up whatever was
+ * published last, skipping any it was too slow to see.  Three buffers
+ * mean each side always has one of its own and the third is in flight.
+ */
+
+#ifndef TRIPLEBUFFER_H
+#define TRIPLEBUFFER_H
+
+#include <atomic>
+
+template<class T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : m_back(0), m_middle(1), m_front(2)
+    {
+    }
+
+    // Writer only.  The buffer to fill next; it is the writer's until
+    // publish().  Its contents are whatever was last written to it, up
+    // to three publishes ago.
+    T &back()
+    {
+        return m_buffers[m_back];
+    }
+
+    // Writer only.  Make the back buffer the latest value.
+    void publish()
+    {
+        m_back = m_middle.exchange(m_back | FRESH, std::memory_order_acq_rel)
+                 & INDEX;
+    }
+
+    // Reader only.  Take the latest published value if there is one the
+    // reader has not seen; returns whether front() changed.
+    bool update()
+    {
+        if (!(m_middle.load(std::memory_order_relaxed) & FRESH))
+            return false;
+        m_front = m_middle.exchange(m_front, std::memory_order_acq_rel)
+                  & INDEX;
+        return true;
+    }
+
+    // Reader only.  Stays valid and unchanged until the next update().
+    const T &front() const
+    {
+        return m_buffers[m_front];
+    }
+
+private:
+    // The middle index carries a flag saying it holds a value published
+    // since the reader last swapped.
+    enum { INDEX = 3, FRESH = 4 };
+
+    T m_buffers[3];
+    int m_back;
+    alignas(64) std::atomic<int> m_middle;
+    alignas(64) int m_front;
+};
+
+#endif // TRIPLEBUFFER_H
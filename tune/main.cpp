@@ -0,0 +1,418 @@
+/*
+ * CPSC 453 - Introduction to Computer Graphics
+ * Assignment 1
+ *
+ * Autoplayer weight tuner - searches for AutoPlayer weights with the
+ * cross-entropy method.  Every generation samples a population of
+ * weight vectors around the current mean, plays each on the same set
+ * of seeded games on all cores, and refits the mean and spread to the
+ * best of them.  Progress is checkpointed after every generation.
+ */
+
+#include "autoplayer.h"
+#include "game.h"
+#include "rng.h"
+#include "scheduler.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+using namespace std;
+
+static const int N = AutoPlayer::NUM_FEATURES;
+
+static const char *FEATURE_NAMES[N] = {
+    "height", "lines", "holes", "bumpiness", "wells", "row-trans", "col-trans"
+};
+
+struct Options
+{
+    int generations;
+    int population;
+    int elite;
+    int games;
+    long maxPieces;
+    int threads;
+    int width;
+    int height;
+    unsigned long long seed;
+    Game::Randomizer randomizer;
+    const char *checkpoint;
+};
+
+// Where the search is.  This is all a checkpoint holds: the options
+// that shape the search, the mean and spread to sample the next
+// generation from, and the best candidate seen so far.
+struct State
+{
+    char run[256];
+    int generation;
+    float mean[N];
+    float sigma[N];
+    float best[N];
+    double bestFitness;
+};
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr,
+            "usage: %s [--generations N] [--population N] [--elite N]\n"
+            "          [--games N] [--max-pieces N] [--threads N]\n"
+            "          [--width N] [--height N] [--seed N] [--bag]\n"
+            "          [--checkpoint FILE]\n",
+            argv0);
+    exit(1);
+}
+
+static Options parseOptions(int argc, char *argv[])
+{
+    Options opt;
+    opt.generations = 20;
+    opt.population = 64;
+    opt.elite = 0;
+    opt.games = 32;
+    opt.maxPieces = 1000;
+    opt.threads = 0;
+    opt.width = 10;
+    opt.height = 24;
+    opt.seed = 1;
+    opt.randomizer = Game::RANDOM_UNIFORM;
+    opt.checkpoint = "tune.ckpt";
+
+    for (int i=1; i<argc; i++)
+    {
+        if (!strcmp(argv[i], "--bag"))
+        {
+            opt.randomizer = Game::RANDOM_BAG;
+            continue;
+        }
+        if (i + 1 >= argc)
+        {
+            usage(argv[0]);
+        }
+        const char *arg = argv[i];
+        const char *val = argv[++i];
+
+        if (!strcmp(arg, "--generations"))
+            opt.generations = atoi(val);
+        else if (!strcmp(arg, "--population"))
+            opt.population = atoi(val);
+        else if (!strcmp(arg, "--elite"))
+            opt.elite = atoi(val);
+        else if (!strcmp(arg, "--games"))
+            opt.games = atoi(val);
+        else if (!strcmp(arg, "--max-pieces"))
+            opt.maxPieces = atol(val);
+        else if (!strcmp(arg, "--threads"))
+            opt.threads = atoi(val);
+        else if (!strcmp(arg, "--width"))
+            opt.width = atoi(val);
+        else if (!strcmp(arg, "--height"))
+            opt.height = atoi(val);
+        else if (!strcmp(arg, "--seed"))
+            opt.seed = strtoull(val, 0, 10);
+        else if (!strcmp(arg, "--checkpoint"))
+            opt.checkpoint = val;
+        else
+            usage(argv[0]);
+    }
+
+    // The top quarter of the population by default
+    if (opt.elite <= 0)
+        opt.elite = max(opt.population / 4, 1);
+    // The autoplayer's boards hold one word per row, and its features
+    // only mean something in a well as wide as a flat I piece
+    if (opt.population < 1 || opt.games < 1 || opt.elite > opt.population ||
+        opt.width < 4 || opt.width > 64 || opt.height < 1 ||
+        opt.height > Game::MAX_HEIGHT)
+        usage(argv[0]);
+
+    return opt;
+}
+
+// Everything but --generations and --threads changes what a generation
+// plays or samples, so a checkpoint is only resumed under the same ones.
+static void describeRun(const Options& opt, char *buf, size_t size)
+{
+    snprintf(buf, size,
+             "%dx%d seed %llu games %d max-pieces %ld population %d "
+             "elite %d %s",
+             opt.width, opt.height, opt.seed, opt.games, opt.maxPieces,
+             opt.population, opt.elite,
+             opt.randomizer == Game::RANDOM_BAG ? "bag" : "uniform");
+}
+
+// Standard normal sample by Box-Muller, from the game's own generator so
+// a run depends only on --seed.
+static float gaussian(Rng& rng)
+{
+    double u = ((rng.next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+    double v = (rng.next() >> 11) * (1.0 / 9007199254740992.0);
+    return (float) (sqrt(-2.0 * log(u)) * cos(6.283185307179586 * v));
+}
+
+// Scores only compare placements, so a weight vector and any positive
+// multiple of it play identically.  Keeping samples on the unit sphere
+// stops the search wandering along that direction.
+static void normalize(float w[N])
+{
+    float length = 0;
+    for (int i=0; i<N; i++)
+        length += w[i] * w[i];
+    length = sqrt(length);
+    if (length > 0)
+    {
+        for (int i=0; i<N; i++)
+            w[i] /= length;
+    }
+}
+
+static void initState(const Options& opt, State& state)
+{
+    AutoPlayer::Weights w = AutoPlayer::defaultWeights();
+    describeRun(opt, state.run, sizeof(state.run));
+    state.generation = 0;
+    for (int i=0; i<N; i++)
+    {
+        state.mean[i] = w.w[i];
+        state.sigma[i] = 0.5f;
+    }
+    normalize(state.mean);
+    memcpy(state.best, state.mean, sizeof(state.best));
+    state.bestFitness = -1;
+}
+
+static void writeRow(FILE *f, const char *name, const float w[N])
+{
+    fprintf(f, "%s", name);
+    for (int i=0; i<N; i++)
+        fprintf(f, " %.9g", w[i]);
+    fprintf(f, "\n");
+}
+
+static bool readRow(FILE *f, const char *name, float w[N])
+{
+    char word[32];
+    if (fscanf(f, "%31s", word) != 1 || strcmp(word, name))
+        return false;
+    for (int i=0; i<N; i++)
+    {
+        if (fscanf(f, "%f", &w[i]) != 1)
+            return false;
+    }
+    return true;
+}
+
+// Checkpoints are small text files, written to a temporary name and
+// renamed over the old one so an interrupted run never leaves half a
+// checkpoint behind.
+static bool saveCheckpoint(const char *path, const State& state)
+{
+    char tmp[4096];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    FILE *f = fopen(tmp, "w");
+    if (!f)
+        return false;
+
+    fprintf(f, "run %s\n", state.run);
+    fprintf(f, "generation %d\n", state.generation);
+    writeRow(f, "mean", state.mean);
+    writeRow(f, "sigma", state.sigma);
+    writeRow(f, "best", state.best);
+    fprintf(f, "fitness %.9g\n", state.bestFitness);
+
+    bool ok = !ferror(f);
+    ok = fclose(f) == 0 && ok;
+    return ok && rename(tmp, path) == 0;
+}
+
+// False if there is no checkpoint at path.  One that is there but cannot
+// be read is an error rather than something to write over.
+static bool loadCheckpoint(const char *path, State& state)
+{
+    FILE *f = fopen(path, "r");
+    if (!f)
+        return false;
+
+    State s;
+    bool ok = fscanf(f, " run %255[^\n]", s.run) == 1 &&
+              fscanf(f, " generation %d", &s.generation) == 1 &&
+              readRow(f, "mean", s.mean) &&
+              readRow(f, "sigma", s.sigma) &&
+              readRow(f, "best", s.best) &&
+              fscanf(f, " fitness %lf", &s.bestFitness) == 1;
+    fclose(f);
+    if (!ok)
+    {
+        fprintf(stderr, "%s is not a checkpoint this tuner can read\n", path);
+        exit(1);
+    }
+    state = s;
+    return true;
+}
+
+// Play one game with the given player, up to maxPieces pieces, and
+// return the rows it cleared.  Every tick after the player's moves
+// locks a piece.
+static long playGame(Game& game, AutoPlayer& player, unsigned long long seed,
+                     long maxPieces)
+{
+    long lines = 0;
+    game.reset(seed);
+    for (long t=0; t<maxPieces; t++)
+    {
+        if (!player.play(game))
+            break;
+        int result = game.tick();
+        if (result < 0)
+            break;
+        lines += result;
+    }
+    return lines;
+}
+
+int main(int argc, char *argv[])
+{
+    Options opt = parseOptions(argc, argv);
+
+    State state;
+    initState(opt, state);
+    char run[sizeof(state.run)];
+    memcpy(run, state.run, sizeof(run));
+    if (loadCheckpoint(opt.checkpoint, state))
+    {
+        if (strcmp(state.run, run))
+        {
+            fprintf(stderr, "%s belongs to another run:\n"
+                    "  checkpoint: %s\n  this run:   %s\n"
+                    "rerun with its options or remove it\n",
+                    opt.checkpoint, state.run, run);
+            return 1;
+        }
+        printf("resuming from %s at generation %d (best %.1f)\n",
+               opt.checkpoint, state.generation, state.bestFitness);
+    }
+
+    Scheduler scheduler(opt.threads);
+    int threads = scheduler.threadCount();
+
+    // One Game and AutoPlayer per worker, reused for every game the
+    // worker plays rather than reallocated.
+    vector<unique_ptr<Game> > games(threads);
+    vector<AutoPlayer> players(threads);
+    for (int i=0; i<threads; i++)
+    {
+        games[i].reset(new Game(opt.width, opt.height, opt.seed,
+                                opt.randomizer));
+    }
+
+    int population = opt.population;
+    vector<AutoPlayer::Weights> candidates(population);
+    vector<long> lines((long) population * opt.games);
+    vector<double> fitness(population);
+    vector<int> order(population);
+
+    printf("tuning on %dx%d, %d candidates x %d games, %d threads\n",
+           opt.width, opt.height, population, opt.games, threads);
+
+    for (; state.generation<opt.generations; state.generation++)
+    {
+        // Sample the generation.  The sampler is seeded per generation so
+        // a resumed run samples what the uninterrupted one would have.
+        Rng rng(opt.seed ^ (0x9E3779B97F4A7C15ULL * (state.generation + 1)));
+        for (int c=0; c<population; c++)
+        {
+            float *w = candidates[c].w;
+            for (int i=0; i<N; i++)
+                w[i] = state.mean[i] + state.sigma[i] * gaussian(rng);
+            normalize(w);
+        }
+
+        // Every candidate plays the same games, so the comparison between
+        // them is not swamped by the luck of the draw.  Each task is one
+        // (candidate, game) pair, and the scheduler balances the short
+        // games of bad candidates against the long ones of good ones.
+        unsigned long long seedBase = opt.seed + (unsigned long long)
+                                      state.generation * opt.games;
+        scheduler.parallelFor(lines.size(), [&](int worker, long index) {
+            int c = index / opt.games;
+            int g = index % opt.games;
+            AutoPlayer& player = players[worker];
+            player.setWeights(candidates[c]);
+            lines[index] = playGame(*games[worker], player, seedBase + g,
+                                    opt.maxPieces);
+        });
+
+        for (int c=0; c<population; c++)
+        {
+            long sum = 0;
+            for (int g=0; g<opt.games; g++)
+                sum += lines[(long) c * opt.games + g];
+            fitness[c] = (double) sum / opt.games;
+            order[c] = c;
+        }
+        sort(order.begin(), order.end(), [&](int a, int b) {
+            return fitness[a] > fitness[b];
+        });
+
+        // Refit to the elite.  The extra noise shrinks over the
+        // generations; without it the spread collapses before the mean
+        // has settled.
+        double meanFitness = 0;
+        for (int k=0; k<opt.elite; k++)
+            meanFitness += fitness[order[k]];
+        meanFitness /= opt.elite;
+
+        float noise = 0.1f / (1 + state.generation);
+        for (int i=0; i<N; i++)
+        {
+            float mean = 0;
+            for (int k=0; k<opt.elite; k++)
+                mean += candidates[order[k]].w[i];
+            mean /= opt.elite;
+
+            float var = 0;
+            for (int k=0; k<opt.elite; k++)
+            {
+                float d = candidates[order[k]].w[i] - mean;
+                var += d * d;
+            }
+            var /= opt.elite;
+
+            state.mean[i] = mean;
+            state.sigma[i] = sqrt(var + noise * noise);
+        }
+        normalize(state.mean);
+
+        const float *top = candidates[order[0]].w;
+        if (fitness[order[0]] > state.bestFitness)
+        {
+            state.bestFitness = fitness[order[0]];
+            memcpy(state.best, top, sizeof(state.best));
+        }
+
+        double seconds = scheduler.lastSeconds();
+        printf("gen %3d:  best %8.1f  elite %8.1f  lines/game  "
+               "%6.0f games/s  %.2f s\n",
+               state.generation, fitness[order[0]], meanFitness,
+               lines.size() / seconds, seconds);
+
+        State next = state;
+        next.generation++;
+        if (!saveCheckpoint(opt.checkpoint, next))
+        {
+            fprintf(stderr, "cannot write %s\n", opt.checkpoint);
+            return 1;
+        }
+    }
+
+    printf("best %.1f lines/game:\n", state.bestFitness);
+    for (int i=0; i<N; i++)
+        printf("  %-10s %9.5f\n", FEATURE_NAMES[i], state.best[i]);
+
+    return 0;
+}
@@ -0,0 +1,13 @@
+######################################################################
+# Autoplayer weight tuner - drives Game without Qt
+######################################################################
+
+TEMPLATE = app
+TARGET = tune
+CONFIG += console c++14 thread
+CONFIG -= qt app_bundle
+INCLUDEPATH += ..
+
+# Input
+HEADERS += ../autoplayer.h ../game.h ../movegen.h ../pieces.h ../rng.h ../scheduler.h
+SOURCES += main.cpp ../autoplayer.cpp ../game.cpp ../movegen.cpp ../scheduler.cpp
@@ -1,16 +1,23 @@
 #include "window.h"
 #include "renderer.h"
+#include "trace.h"
+#include <QDateTime>
+#include <QFile>
+#include <QFileDialog>
 #include <iostream>
 
 using namespace std;
 
-Window::Window(QWidget *parent) :
+Window::Window(int width, int height, QWidget *parent) :
     QMainWindow(parent)
 {
     setWindowTitle("CPSC453: Tetromino Apocalypse");
 
+    gameHeight = height;
+    gameWidth = width;
+
     // Create the main drawing object
-    renderer = new Renderer();
+    renderer = new Renderer(gameWidth, gameHeight);
 
     // Create the actions to be used by the menus
     createFileActions();
@@ -22,6 +29,10 @@ Window::Window(QWidget *parent) :
     mFileMenu = menuBar()->addMenu(tr("&File"));
     mFileMenu->addAction(mNewGameAction);
     mFileMenu->addAction(mResetAction);  // add resetting the scales/rotation
+    mFileMenu->addAction(mSaveReplayAction);
+#ifdef TRACE_ENABLED
+    mFileMenu->addAction(mSaveTraceAction);
+#endif
     mFileMenu->addAction(mQuitAction);  // add quitting
 
     // Setup the Draw menu
@@ -43,6 +54,8 @@ Window::Window(QWidget *parent) :
     mGameMenu->addAction(mSpeedUpAction);
     mGameMenu->addAction(mSpeedDownAction);
     mGameMenu->addAction(mSpeedAutoAction);
+    mGameMenu->addAction(mTurboAction);
+    mGameMenu->addAction(mAutoPlayAction);
 
     scoreBoard = new QWindow();
     scoreBoard->setTitle("SCORE");
@@ -58,22 +71,29 @@ Window::Window(QWidget *parent) :
     mainWidget->setLayout(layout);
     setCentralWidget(mainWidget);
 
-    // game timer
-    this->m_pGameTimer = new QTimer(this);
-    connect(this->m_pGameTimer, SIGNAL(timeout()), this, SLOT(timer_tick()));
-    gameSpeed = 300;
+    // Seed from the clock so every session plays differently; the replay
+    // keeps the seed so a game can still be played back.
+    unsigned long long seed = QDateTime::currentMSecsSinceEpoch();
+    gameThread = new GameThread(gameWidth, gameHeight, seed);
+    connect(gameThread, SIGNAL(replayReady(QByteArray)),
+            this, SLOT(replayReady(QByteArray)));
+    connect(gameThread, SIGNAL(framePublished()),
+            this, SLOT(framePublished()));
+    connect(renderer, SIGNAL(frameSwapped()), this, SLOT(frameSwapped()));
+    paused = false;
     gameSpeedAuto = false;
-    this->m_pGameTimer->start(gameSpeed);// ms
-
-    // drawing timer
-    this->m_pDrawTimer = new QTimer(this);
-    connect(this->m_pDrawTimer, SIGNAL(timeout()), this, SLOT(draw_tick()));
-    this->m_pDrawTimer->start(33); // 30fps
+    gameTurbo = false;
+    autoPlaying = false;
 
-    gameHeight = 24;
-    gameWidth = 10;
+    lastFrameSerial = -1;
+    framesSkipped = 0;
+    cellsUpdated = 0;
+    framesReported = 0;
+    bytesReported = 0;
+    drawNanosReported = 0;
+    frameStatsClock.start();
 
-    game = new Game(gameWidth, gameHeight);
+    gameThread->start();
 
 }
 
@@ -90,6 +110,16 @@ void Window::createFileActions()
     mResetAction->setShortcut(QKeySequence(Qt::Key_R));
     connect(mResetAction, SIGNAL(triggered()), this, SLOT(resetView()));
 
+    // Save a replay of the game so far
+    mSaveReplayAction = new QAction(tr("&Save Replay..."), this);
+    mSaveReplayAction->setShortcut(QKeySequence(Qt::Key_S));
+    connect(mSaveReplayAction, SIGNAL(triggered()), this, SLOT(saveReplay()));
+
+    // Save the trace of the last few seconds, in builds that keep one
+    mSaveTraceAction = new QAction(tr("Save &Trace..."), this);
+    mSaveTraceAction->setShortcut(QKeySequence(Qt::Key_F12));
+    connect(mSaveTraceAction, SIGNAL(triggered()), this, SLOT(saveTrace()));
+
     // Quits the application
     mQuitAction = new QAction(tr("&Quit"), this);
     mQuitAction->setShortcut(QKeySequence(Qt::Key_Q));
@@ -146,6 +176,19 @@ void Window::createGameActions()
     mSpeedAutoAction->setShortcut(QKeySequence(Qt::Key_A));
     mSpeedAutoAction->setCheckable(true);
     connect(mSpeedAutoAction, SIGNAL(triggered()), this, SLOT(speedAuto()));
+
+    // Turbo: thousands of ticks a second, still drawn at display rate
+    mTurboAction = new QAction(tr("&Turbo"), this);
+    mTurboAction->setShortcut(QKeySequence(Qt::Key_T));
+    mTurboAction->setCheckable(true);
+    connect(mTurboAction, SIGNAL(triggered()), this, SLOT(turbo()));
+
+    // Autoplay
+    mAutoPlayAction = new QAction(tr("Auto&play"), this);
+    mAutoPlayAction->setShortcut(QKeySequence(Qt::Key_O));
+    mAutoPlayAction->setCheckable(true);
+    mAutoPlayAction->setEnabled(gameWidth <= 64); // bots see 64 columns
+    connect(mAutoPlayAction, SIGNAL(triggered()), this, SLOT(autoPlay()));
 }
 
 void Window::wireframe()
@@ -167,40 +210,86 @@ void Window::randomColored()
 
 void Window::pause()
 {
-    if (m_pGameTimer->isActive())
-    {
-        m_pGameTimer->stop();
-        mPauseAction->setChecked(true);
-    }
-    else
-    {
-        m_pGameTimer->start(gameSpeed);
-        mPauseAction->setChecked(false);
-    }
+    paused = !paused;
+    mPauseAction->setChecked(paused);
+    gameThread->post(GameThread::COMMAND_PAUSE);
 }
 
 void Window::speedUp()
 {
-    gameSpeed -= 5;
-    m_pGameTimer->start(gameSpeed);
+    gameThread->post(GameThread::COMMAND_SPEED_UP);
 }
 
 void Window::speedDown()
 {
-    gameSpeed += 5;
-    m_pGameTimer->start(gameSpeed);
+    gameThread->post(GameThread::COMMAND_SPEED_DOWN);
 }
 
 void Window::speedAuto()
 {
     gameSpeedAuto = !gameSpeedAuto;
     mSpeedAutoAction->setChecked(gameSpeedAuto);
+    gameThread->post(GameThread::COMMAND_SPEED_AUTO);
+}
+
+void Window::turbo()
+{
+    gameTurbo = !gameTurbo;
+    mTurboAction->setChecked(gameTurbo);
+    gameThread->post(GameThread::COMMAND_TURBO);
+}
+
+void Window::autoPlay()
+{
+    autoPlaying = !autoPlaying;
+    mAutoPlayAction->setChecked(autoPlaying);
+    gameThread->post(GameThread::COMMAND_AUTOPLAY);
+}
+
+void Window::applyMove(Game::Move move)
+{
+    gameThread->post(GameThread::COMMAND_MOVE, move);
 }
 
 void Window::newGame()
 {
-    gameSpeed = 300;
-    game->reset();
+    gameThread->post(GameThread::COMMAND_NEW_GAME);
+}
+
+// The game thread closes a copy of its replay and hands it back through
+// replayReady(), where it is saved.
+void Window::saveReplay()
+{
+    gameThread->post(GameThread::COMMAND_SAVE_REPLAY);
+}
+
+void Window::replayReady(QByteArray data)
+{
+    QString path = QFileDialog::getSaveFileName(this, tr("Save Replay"),
+                                                "game.trp",
+                                                tr("Replays (*.trp)"));
+    if (path.isEmpty())
+    {
+        return;
+    }
+    QFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size())
+    {
+        QMessageBox::warning(this, tr("Save Replay"),
+                             tr("Cannot write %1").arg(path));
+    }
+}
+
+void Window::saveTrace()
+{
+    QString path = QFileDialog::getSaveFileName(this, tr("Save Trace"),
+                                                "trace.json",
+                                                tr("Chrome traces (*.json)"));
+    if (!path.isEmpty() && !traceWrite(path.toLocal8Bit().constData()))
+    {
+        QMessageBox::warning(this, tr("Save Trace"),
+                             tr("Cannot write %1").arg(path));
+    }
 }
 
 void Window::resetView()
@@ -208,55 +297,92 @@ void Window::resetView()
     renderer->resetView();
 }
 
-void Window::draw_tick()
+bool Window::takeFrame()
 {
-    renderer->update();
+    const BoardFrame *frame = gameThread->takeFrame();
+    if (!frame)
+    {
+        return false;
+    }
+    framesSkipped += frame->serial - lastFrameSerial - 1;
+    lastFrameSerial = frame->serial;
+    renderer->applyFrame(*frame);
+    cellsUpdated += renderer->cellsUpdated();
+    return true;
 }
 
-void Window::timer_tick()
+void Window::frameSwapped()
 {
-    cout << "Tick" << endl;
-    if (gameSpeedAuto)
+    TRACE_SCOPE("Window::frameSwapped");
+    if (takeFrame() || renderer->isAnimating())
+    {
+        renderer->update();
+    }
+    else
     {
-        gameSpeed--;
-        if (gameSpeed < 50)
+        // Nothing to draw: go idle until the game publishes again.  A
+        // frame published before the request is caught by looking once
+        // more.
+        gameThread->wakeOnPublish();
+        if (takeFrame())
         {
-            gameSpeed = 50;
+            renderer->update();
         }
-        m_pGameTimer->setInterval(gameSpeed);
     }
 
-    game->tick();
-
-    int board[gameHeight][10];
+    if (frameStatsClock.elapsed() >= 5000)
+    {
+        long rendered = renderer->framesRendered();
+        cout << "Frames: " << rendered - framesReported << " rendered, "
+             << framesSkipped << " skipped, " << cellsUpdated
+             << " cells updated in " << frameStatsClock.elapsed() / 1000.0
+             << " s; " << renderer->drawCalls() << " draw calls a frame ("
+             << (rendered > framesReported ?
+                 (renderer->drawNanos() - drawNanosReported) /
+                 (rendered - framesReported) / 1000.0 : 0.0)
+             << " us to issue), " << renderer->bytesUploaded() - bytesReported
+             << " bytes uploaded" << endl;
+        const BufferPool &buffers = renderer->buffers();
+        cout << "GPU buffers: " << buffers.liveBuffers() << " live, "
+             << buffers.liveBytes() << " bytes (peak "
+             << buffers.peakBytes() << "), " << buffers.freeBuffers()
+             << " free, " << buffers.allocations() << " allocated" << endl;
+        framesReported = rendered;
+        bytesReported = renderer->bytesUploaded();
+        drawNanosReported = renderer->drawNanos();
+        framesSkipped = 0;
+        cellsUpdated = 0;
+        frameStatsClock.restart();
+    }
+}
 
-    for (int r=0; r<gameHeight; r++)
+void Window::framePublished()
+{
+    TRACE_SCOPE("Window::framePublished");
+    if (takeFrame())
     {
-        for (int c=0; c<gameWidth; c++)
-        {
-            board[r][c] = game->get(r,c);
-        }
+        renderer->update();
     }
-    renderer->setupGameBoard(board);
 }
 
 void Window::keyPressEvent(QKeyEvent *event)
 {
+    TRACE_SCOPE("Window::keyPressEvent");
     switch(event->key()){
     case Qt::Key_Left :
-        game->moveLeft();
+        applyMove(Game::MOVE_LEFT);
         break;
     case Qt::Key_Right :
-        game->moveRight();
+        applyMove(Game::MOVE_RIGHT);
         break;
     case Qt::Key_Up :
-        game->rotateCCW();
+        applyMove(Game::MOVE_CCW);
         break;
     case Qt::Key_Down :
-        game->rotateCW();
+        applyMove(Game::MOVE_CW);
         break;
     case Qt::Key_Space :
-        game->drop();
+        applyMove(Game::MOVE_DROP);
         break;
     case Qt::Key_Shift :
         renderer->setShiftStatus(true);
@@ -277,5 +403,6 @@ void Window::keyReleaseEvent(QKeyEvent *event)
 // destructor
 Window::~Window()
 {
+    delete gameThread;
     delete renderer;
 }
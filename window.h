@@ -18,7 +18,8 @@
 #include <QActionGroup>
 #include <QTimer>
 #include <QWindow>
-#include "game.h"
+#include <QElapsedTimer>
+#include "gamethread.h"
 
 class Renderer;
 
@@ -28,8 +29,8 @@ class Window : public QMainWindow
     Q_OBJECT
 
 public:
-    // constructor
-    Window(QWidget *parent = 0);
+    // constructor, for a well of the given size
+    Window(int width = 10, int height = 24, QWidget *parent = 0);
 
     virtual void keyPressEvent(QKeyEvent *event);
     virtual void keyReleaseEvent(QKeyEvent *event);
@@ -38,10 +39,13 @@ public:
     ~Window();
 
 private slots:
-    void draw_tick();
-    void timer_tick();
+    void frameSwapped();
+    void framePublished();
     void newGame();
     void resetView();
+    void saveReplay();
+    void replayReady(QByteArray data);
+    void saveTrace();
 
     void wireframe();
     void face();
@@ -52,6 +56,8 @@ private slots:
     void speedUp();
     void speedDown();
     void speedAuto();
+    void turbo();
+    void autoPlay();
 
 private:
     // Main widget for drawing
@@ -61,6 +67,8 @@ private:
     QMenu * mFileMenu;
     QAction * mNewGameAction;
     QAction * mResetAction;
+    QAction * mSaveReplayAction;
+    QAction * mSaveTraceAction;
     QAction * mQuitAction;
 
     QActionGroup * drawGroup;
@@ -76,25 +84,46 @@ private:
     QAction * mSpeedUpAction;
     QAction * mSpeedDownAction;
     QAction * mSpeedAutoAction;
+    QAction * mTurboAction;
+    QAction * mAutoPlayAction;
 
     QWindow * scoreBoard;
 
-    // Timer
-    QTimer *m_pGameTimer;
-    QTimer *m_pDrawTimer;
-
     // helper function for creating actions
     void createFileActions();
     void createDrawActions();
     void createGameActions();
 
+    // hand a move to the game thread
+    void applyMove(Game::Move move);
+
+    // Give the renderer the latest frame from the game, if there is one
+    // it has not had.
+    bool takeFrame();
+
+    // Drawing happens only when something changed: a new frame from the
+    // game, input on the view, or a spin still going.  Each drawn frame
+    // asks for the next from frameSwapped(), so that runs at display
+    // rate; when there is nothing to draw the chain stops, and the game
+    // thread starts it again with framePublished().
+    long lastFrameSerial;
+    long framesSkipped;     // published by the game but never taken
+    long cellsUpdated;
+    long framesReported;
+    long bytesReported;
+    long drawNanosReported;
+    QElapsedTimer frameStatsClock;
+
     int gameHeight;
     int gameWidth;
 
-    float gameSpeed;
+    // The game itself runs on gameThread; these only mirror the
+    // toggles it was sent, for the menu check marks.
+    GameThread *gameThread;
+    bool paused;
     bool gameSpeedAuto;
-
-    Game *game;
+    bool gameTurbo;
+    bool autoPlaying;
 
 };
 